@@ -102,6 +102,13 @@ typedef enum
   CSD_POWER_ACTION_NOTHING
 } CsdPowerActionType;
 
+typedef enum
+{
+  CSD_POWER_FADE_EASING_LINEAR,
+  CSD_POWER_FADE_EASING_EASE_OUT,
+  CSD_POWER_FADE_EASING_EASE_IN_OUT
+} CsdPowerFadeEasing;
+
 typedef enum
 {
   CSD_UPDATE_TYPE_ALL,
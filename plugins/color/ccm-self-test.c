@@ -23,12 +23,17 @@
 
 #include <glib.h>
 #include <glib-object.h>
+#include <colord.h>
+#include <math.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include "ccm-edid.h"
 #include "csd-color-state.h"
 #include "csd-night-light.h"
 #include "csd-night-light-common.h"
+#include "blackbody-rgb.h"
+#include "tz-coords.h"
 
 GMainLoop *mainloop;
 
@@ -379,6 +384,122 @@ ccm_test_sunset_sunrise_fractional_timezone (void)
         g_assert_cmpfloat (sunset, >, sunset_actual - 0.1);
 }
 
+/* push everything out of the sunrise and sunset memo */
+static void
+ccm_test_sunset_sunrise_evict (void)
+{
+        gdouble sunrise;
+        gdouble sunset;
+        guint i;
+
+        for (i = 0; i < 16; i++) {
+                g_autoptr(GDateTime) dt = g_date_time_new_utc (1950, 6, 1 + i, 12, 0, 0);
+                csd_night_light_get_sunrise_sunset (dt, 10.f + i, 20.f, &sunrise, &sunset);
+        }
+}
+
+static void
+ccm_test_sunset_sunrise_cold (GDateTime *dt, gdouble pos_lat, gdouble pos_long,
+                              gdouble *sunrise, gdouble *sunset)
+{
+        ccm_test_sunset_sunrise_evict ();
+        csd_night_light_get_sunrise_sunset (dt, pos_lat, pos_long, sunrise, sunset);
+}
+
+static void
+ccm_test_sunset_sunrise_memo_keys (void)
+{
+        g_autoptr(GTimeZone) tz = g_time_zone_new ("+01:30");
+        g_autoptr(GDateTime) dt = g_date_time_new_utc (2007, 2, 1, 12, 0, 0);
+        g_autoptr(GDateTime) dt_later = g_date_time_new_utc (2007, 2, 1, 18, 0, 0);
+        g_autoptr(GDateTime) dt_day = g_date_time_new_utc (2007, 6, 1, 12, 0, 0);
+        g_autoptr(GDateTime) dt_offset = g_date_time_to_timezone (dt, tz);
+        gdouble sunrise;
+        gdouble sunrise_cold;
+        gdouble sunrise_day;
+        gdouble sunrise_location;
+        gdouble sunrise_offset;
+        gdouble sunset;
+        gdouble sunset_cold;
+        gdouble sunset_day;
+        gdouble sunset_location;
+        gdouble sunset_offset;
+
+        /* what each key computes with nothing remembered */
+        ccm_test_sunset_sunrise_cold (dt_day, 51.5, -0.1278, &sunrise_day, &sunset_day);
+        ccm_test_sunset_sunrise_cold (dt, 40.7, -74.0, &sunrise_location, &sunset_location);
+        ccm_test_sunset_sunrise_cold (dt_offset, 51.5, -0.1278, &sunrise_offset, &sunset_offset);
+        ccm_test_sunset_sunrise_cold (dt, 51.5, -0.1278, &sunrise_cold, &sunset_cold);
+
+        /* a hit returns exactly what the cold computation did */
+        csd_night_light_get_sunrise_sunset (dt_later, 51.5, -0.1278, &sunrise, &sunset);
+        g_assert_cmpfloat (sunrise, ==, sunrise_cold);
+        g_assert_cmpfloat (sunset, ==, sunset_cold);
+
+        /* a different day, location or UTC offset must not hit that entry */
+        csd_night_light_get_sunrise_sunset (dt_day, 51.5, -0.1278, &sunrise, &sunset);
+        g_assert_cmpfloat (sunrise, ==, sunrise_day);
+        g_assert_cmpfloat (sunset, ==, sunset_day);
+        g_assert_cmpfloat (sunrise, !=, sunrise_cold);
+
+        csd_night_light_get_sunrise_sunset (dt, 40.7, -74.0, &sunrise, &sunset);
+        g_assert_cmpfloat (sunrise, ==, sunrise_location);
+        g_assert_cmpfloat (sunset, ==, sunset_location);
+        g_assert_cmpfloat (sunrise, !=, sunrise_cold);
+
+        csd_night_light_get_sunrise_sunset (dt_offset, 51.5, -0.1278, &sunrise, &sunset);
+        g_assert_cmpfloat (sunrise, ==, sunrise_offset);
+        g_assert_cmpfloat (sunset, ==, sunset_offset);
+        g_assert_cmpfloat (sunrise, <, sunrise_cold + 1.5 + 0.01);
+        g_assert_cmpfloat (sunrise, >, sunrise_cold + 1.5 - 0.01);
+}
+
+static void
+ccm_test_sunset_sunrise_memo (void)
+{
+        gdouble sunrise;
+        gdouble sunrise_first = 0;
+        gdouble sunset;
+        gdouble sunset_first = 0;
+        gdouble elapsed_cached;
+        gdouble elapsed_uncached;
+        const guint loops = 100000;
+        guint i;
+
+        /* a different day each time, so nothing is remembered */
+        g_test_timer_start ();
+        for (i = 0; i < loops; i++) {
+                g_autoptr(GDateTime) dt = g_date_time_new_utc (1900 + i % 200,
+                                                               1 + (i / 200) % 12,
+                                                               1 + (i / 2400) % 28,
+                                                               0, 0, 0);
+                csd_night_light_get_sunrise_sunset (dt, 51.5, -0.1278, &sunrise, &sunset);
+        }
+        elapsed_uncached = g_test_timer_elapsed ();
+
+        /* the same day all the time, like the night light schedule */
+        g_test_timer_start ();
+        for (i = 0; i < loops; i++) {
+                g_autoptr(GDateTime) dt = g_date_time_new_utc (2007, 2, 1, i % 24, 0, 0);
+                csd_night_light_get_sunrise_sunset (dt, 51.5, -0.1278, &sunrise, &sunset);
+                if (i == 0) {
+                        sunrise_first = sunrise;
+                        sunset_first = sunset;
+                }
+                g_assert_cmpfloat (sunrise, ==, sunrise_first);
+                g_assert_cmpfloat (sunset, ==, sunset_first);
+        }
+        elapsed_cached = g_test_timer_elapsed ();
+        g_test_message ("%u lookups: %.3fs uncached, %.3fs cached",
+                        loops, elapsed_uncached, elapsed_cached);
+
+        /* the remembered values are the computed ones */
+        g_assert_cmpfloat (sunrise, <, 7.6 + 0.1);
+        g_assert_cmpfloat (sunrise, >, 7.6 - 0.1);
+        g_assert_cmpfloat (sunset, <, 16.8 + 0.1);
+        g_assert_cmpfloat (sunset, >, 16.8 - 0.1);
+}
+
 static void
 ccm_test_frac_day (void)
 {
@@ -409,6 +530,46 @@ ccm_test_frac_day (void)
         g_assert_true (csd_night_light_frac_day_is_between (0.5, 0.5, 0.5));
 }
 
+static void
+ccm_test_blackbody_rgb (void)
+{
+        CdColorRGB rgb;
+        const gfloat *entry;
+        guint temperature;
+        guint i = 0;
+
+        g_assert_cmpuint (G_N_ELEMENTS (blackbody_rgb_list), ==,
+                          (BLACKBODY_TEMPERATURE_MAX - BLACKBODY_TEMPERATURE_MIN) / BLACKBODY_TEMPERATURE_STEP + 1);
+
+        /* the table must give the tint colord itself would */
+        for (temperature = BLACKBODY_TEMPERATURE_MIN;
+             temperature <= BLACKBODY_TEMPERATURE_MAX;
+             temperature += BLACKBODY_TEMPERATURE_STEP) {
+                entry = blackbody_rgb_list[i++];
+                g_assert_true (cd_color_get_blackbody_rgb_full (temperature, &rgb,
+                                                                CD_COLOR_BLACKBODY_FLAG_USE_PLANCKIAN));
+                g_assert_cmpfloat (fabs (entry[0] - rgb.R), <, 0.0001);
+                g_assert_cmpfloat (fabs (entry[1] - rgb.G), <, 0.0001);
+                g_assert_cmpfloat (fabs (entry[2] - rgb.B), <, 0.0001);
+        }
+}
+
+static void
+ccm_test_tz_coords_sorted (void)
+{
+        guint i;
+
+        /* lookup_tz_coords() relies on both lists being in strcmp() order */
+        for (i = 1; i < G_N_ELEMENTS (tz_coord_list); i++)
+                g_assert_cmpint (strcmp (tz_coord_list[i - 1].timezone, tz_coord_list[i].timezone), <, 0);
+
+        for (i = 0; i < TZ_ALIAS_COUNT; i++) {
+                g_assert_cmpuint (tz_alias_list[i].index, <, G_N_ELEMENTS (tz_coord_list));
+                if (i > 0)
+                        g_assert_cmpint (strcmp (tz_alias_list[i - 1].alias, tz_alias_list[i].alias), <, 0);
+        }
+}
+
 int
 main (int argc, char **argv)
 {
@@ -421,6 +582,11 @@ main (int argc, char **argv)
         g_test_add_func ("/color/edid", ccm_test_edid_func);
         g_test_add_func ("/color/sunset-sunrise", ccm_test_sunset_sunrise);
         g_test_add_func ("/color/sunset-sunrise/fractional-timezone", ccm_test_sunset_sunrise_fractional_timezone);
+        g_test_add_func ("/color/sunset-sunrise/memo-keys", ccm_test_sunset_sunrise_memo_keys);
+        if (g_test_perf ())
+                g_test_add_func ("/color/sunset-sunrise/memo", ccm_test_sunset_sunrise_memo);
+        g_test_add_func ("/color/blackbody-rgb", ccm_test_blackbody_rgb);
+        g_test_add_func ("/color/tz-coords/sorted", ccm_test_tz_coords_sorted);
         g_test_add_func ("/color/fractional-day", ccm_test_frac_day);
         g_test_add_func ("/color/night-light", ccm_test_night_light);
 
@@ -21,6 +21,7 @@
 #include "config.h"
 
 #include <glib/gi18n.h>
+#include <glib/gstdio.h>
 #include <colord.h>
 #include <gdk/gdk.h>
 #include <stdlib.h>
@@ -39,6 +40,7 @@
 #include "csd-color-manager.h"
 #include "csd-color-state.h"
 #include "ccm-edid.h"
+#include "blackbody-rgb.h"
 
 #define CSD_DBUS_NAME "org.gnome.SettingsDaemon"
 #define CSD_DBUS_PATH "/org/gnome/SettingsDaemon"
@@ -55,9 +57,15 @@ struct _CsdColorState
         CdClient        *client;
         GnomeRRScreen   *state_screen;
         GHashTable      *edid_cache;
+        GKeyFile        *profile_index;
+        gchar           *profile_index_path;
         GdkWindow       *gdk_window;
         gboolean         session_is_active;
         GHashTable      *device_assign_hash;
+        GHashTable      *vcgt_cache;
+        GHashTable      *output_devices;
+        GHashTable      *crtc_ramps;
+        CcmSessionVcgt  *linear_vcgt;
         guint            color_temperature;
 };
 
@@ -71,11 +79,32 @@ G_DEFINE_TYPE (CsdColorState, csd_color_state, G_TYPE_OBJECT)
 #define CCM_ICC_PROFILE_IN_X_VERSION_MAJOR      0
 #define CCM_ICC_PROFILE_IN_X_VERSION_MINOR      3
 
+/* the VCGT of one profile sampled at one gamma size, before the
+ * color temperature is applied */
 typedef struct {
-        guint32          red;
-        guint32          green;
-        guint32          blue;
-} GnomeRROutputClutItem;
+        gchar           *object_path;
+        guint            size;
+        gfloat          *red;
+        gfloat          *green;
+        gfloat          *blue;
+} CcmSessionVcgt;
+
+/* planar gamma ramp in the form XRandR takes it, one per CRTC */
+typedef struct {
+        guint            size;
+        guint16         *red;
+        guint16         *green;
+        guint16         *blue;
+        guint32          fingerprint;   /* of what the CRTC has now */
+        gboolean         fingerprint_valid;
+} CcmSessionRamp;
+
+/* what colord last told us about an output, so that a temperature
+ * change can be applied without asking it again */
+typedef struct {
+        CdDevice        *device;
+        CdProfile       *profile;       /* connected, or NULL */
+} CcmSessionOutputDevice;
 
 GQuark
 csd_color_state_error_quark (void)
@@ -432,21 +461,23 @@ out:
         return ret;
 }
 
-static GPtrArray *
-ccm_session_generate_vcgt (CdProfile *profile, guint color_temperature, guint size)
+static void
+ccm_session_vcgt_free (CcmSessionVcgt *vcgt)
 {
-        GnomeRROutputClutItem *tmp;
-        GPtrArray *array = NULL;
-        const cmsToneCurve **vcgt;
+        g_free (vcgt->object_path);
+        g_free (vcgt->red);
+        g_free (vcgt);
+}
+
+static CcmSessionVcgt *
+ccm_session_vcgt_new (CdProfile *profile, guint size)
+{
+        CcmSessionVcgt *vcgt = NULL;
+        const cmsToneCurve **curves;
         cmsFloat32Number in;
         guint i;
         cmsHPROFILE lcms_profile;
         CdIcc *icc = NULL;
-        CdColorRGB temp;
-
-        /* invalid size */
-        if (size == 0)
-                goto out;
 
         /* open file */
         icc = cd_profile_load_icc (profile, CD_ICC_LOAD_FLAGS_NONE, NULL, NULL);
@@ -455,37 +486,140 @@ ccm_session_generate_vcgt (CdProfile *profile, guint color_temperature, guint si
 
         /* get tone curves from profile */
         lcms_profile = cd_icc_get_handle (icc);
-        vcgt = cmsReadTag (lcms_profile, cmsSigVcgtTag);
-        if (vcgt == NULL || vcgt[0] == NULL) {
+        curves = cmsReadTag (lcms_profile, cmsSigVcgtTag);
+        if (curves == NULL || curves[0] == NULL) {
                 g_debug ("profile does not have any VCGT data");
                 goto out;
         }
 
-        /* get the color temperature */
-        if (!cd_color_get_blackbody_rgb_full (color_temperature,
-                                              &temp,
-                                              CD_COLOR_BLACKBODY_FLAG_USE_PLANCKIAN)) {
-                g_warning ("failed to get blackbody for %uK", color_temperature);
-                cd_color_rgb_set (&temp, 1.0, 1.0, 1.0);
-        } else {
-                g_debug ("using VCGT gamma of %uK = %.1f,%.1f,%.1f",
-                         color_temperature, temp.R, temp.G, temp.B);
-        }
-
-        /* create array */
-        array = g_ptr_array_new_with_free_func (g_free);
+        /* sample the curves once, all three channels in one block */
+        vcgt = g_new0 (CcmSessionVcgt, 1);
+        vcgt->object_path = g_strdup (cd_profile_get_object_path (profile));
+        vcgt->size = size;
+        vcgt->red = g_new (gfloat, size * 3);
+        vcgt->green = vcgt->red + size;
+        vcgt->blue = vcgt->green + size;
         for (i = 0; i < size; i++) {
                 in = (gdouble) i / (gdouble) (size - 1);
-                tmp = g_new0 (GnomeRROutputClutItem, 1);
-                tmp->red = cmsEvalToneCurveFloat(vcgt[0], in) * temp.R * (gdouble) 0xffff;
-                tmp->green = cmsEvalToneCurveFloat(vcgt[1], in) * temp.G * (gdouble) 0xffff;
-                tmp->blue = cmsEvalToneCurveFloat(vcgt[2], in) * temp.B * (gdouble) 0xffff;
-                g_ptr_array_add (array, tmp);
+                vcgt->red[i] = cmsEvalToneCurveFloat (curves[0], in);
+                vcgt->green[i] = cmsEvalToneCurveFloat (curves[1], in);
+                vcgt->blue[i] = cmsEvalToneCurveFloat (curves[2], in);
         }
 out:
         if (icc != NULL)
                 g_object_unref (icc);
-        return array;
+        return vcgt;
+}
+
+/* loading the ICC and evaluating the curves is far too slow to do on
+ * every night light step, so keep the result for each profile */
+static const gchar *
+ccm_session_get_vcgt_key (CdProfile *profile)
+{
+        const gchar *key;
+
+        key = cd_profile_get_metadata_item (profile, CD_PROFILE_METADATA_FILE_CHECKSUM);
+        if (key == NULL)
+                key = cd_profile_get_filename (profile);
+        return key;
+}
+
+static CcmSessionVcgt *
+ccm_session_get_vcgt (CsdColorState *state, CdProfile *profile, guint size)
+{
+        CcmSessionVcgt *vcgt;
+        const gchar *key;
+
+        key = ccm_session_get_vcgt_key (profile);
+        g_return_val_if_fail (key != NULL, NULL);
+
+        vcgt = g_hash_table_lookup (state->vcgt_cache, key);
+        if (vcgt != NULL && vcgt->size == size)
+                return vcgt;
+
+        vcgt = ccm_session_vcgt_new (profile, size);
+        if (vcgt == NULL)
+                return NULL;
+        g_debug ("caching %u point VCGT for %s", size, key);
+        g_hash_table_insert (state->vcgt_cache, g_strdup (key), vcgt);
+        return vcgt;
+}
+
+static gboolean
+ccm_session_vcgt_matches_profile_cb (gpointer key, gpointer value, gpointer user_data)
+{
+        CcmSessionVcgt *vcgt = (CcmSessionVcgt *) value;
+        return g_strcmp0 (vcgt->object_path, user_data) == 0;
+}
+
+static void
+ccm_session_output_device_free (CcmSessionOutputDevice *output_device)
+{
+        g_object_unref (output_device->device);
+        if (output_device->profile != NULL)
+                g_object_unref (output_device->profile);
+        g_free (output_device);
+}
+
+static void
+ccm_session_output_device_set (CsdColorState *state,
+                               GnomeRROutput *output,
+                               CdDevice *device,
+                               CdProfile *profile)
+{
+        CcmSessionOutputDevice *output_device;
+
+        output_device = g_new0 (CcmSessionOutputDevice, 1);
+        output_device->device = g_object_ref (device);
+        if (profile != NULL)
+                output_device->profile = g_object_ref (profile);
+        g_hash_table_insert (state->output_devices,
+                             g_strdup (gnome_rr_output_get_name (output)),
+                             output_device);
+}
+
+static gboolean
+ccm_session_output_device_matches_profile_cb (gpointer key, gpointer value, gpointer user_data)
+{
+        CcmSessionOutputDevice *output_device = (CcmSessionOutputDevice *) value;
+
+        if (output_device->profile == NULL)
+                return FALSE;
+        return g_strcmp0 (cd_profile_get_object_path (output_device->profile), user_data) == 0;
+}
+
+static gboolean
+ccm_session_output_device_matches_device_cb (gpointer key, gpointer value, gpointer user_data)
+{
+        CcmSessionOutputDevice *output_device = (CcmSessionOutputDevice *) value;
+        return g_strcmp0 (cd_device_get_object_path (output_device->device), user_data) == 0;
+}
+
+static void
+ccm_session_output_device_invalidate (CsdColorState *state, CdDevice *device)
+{
+        g_hash_table_foreach_remove (state->output_devices,
+                                     ccm_session_output_device_matches_device_cb,
+                                     (gpointer) cd_device_get_object_path (device));
+}
+
+static void
+ccm_session_profile_changed_cb (CdClient *client,
+                                CdProfile *profile,
+                                CsdColorState *state)
+{
+        guint removed;
+
+        /* the next gamma update has to look the device up again */
+        g_hash_table_foreach_remove (state->output_devices,
+                                     ccm_session_output_device_matches_profile_cb,
+                                     (gpointer) cd_profile_get_object_path (profile));
+
+        removed = g_hash_table_foreach_remove (state->vcgt_cache,
+                                               ccm_session_vcgt_matches_profile_cb,
+                                               (gpointer) cd_profile_get_object_path (profile));
+        if (removed > 0)
+                g_debug ("dropped cached VCGT for %s", cd_profile_get_object_path (profile));
 }
 
 static guint
@@ -503,144 +637,233 @@ gnome_rr_output_get_gamma_size (GnomeRROutput *output)
         return (guint) len;
 }
 
+/* the identity curve, used when the profile has no VCGT */
+static CcmSessionVcgt *
+ccm_session_get_linear_vcgt (CsdColorState *state, guint size)
+{
+        CcmSessionVcgt *vcgt = state->linear_vcgt;
+        guint i;
+
+        if (vcgt != NULL && vcgt->size == size)
+                return vcgt;
+        g_clear_pointer (&state->linear_vcgt, ccm_session_vcgt_free);
+
+        vcgt = g_new0 (CcmSessionVcgt, 1);
+        vcgt->size = size;
+        vcgt->red = g_new (gfloat, size * 3);
+        vcgt->green = vcgt->red + size;
+        vcgt->blue = vcgt->green + size;
+        for (i = 0; i < size; i++) {
+                vcgt->red[i] = (gfloat) i / (gfloat) (size - 1);
+                vcgt->green[i] = vcgt->red[i];
+                vcgt->blue[i] = vcgt->red[i];
+        }
+        state->linear_vcgt = vcgt;
+        return vcgt;
+}
+
+static void
+ccm_session_ramp_free (CcmSessionRamp *ramp)
+{
+        g_free (ramp->red);
+        g_free (ramp);
+}
+
+/* reuse the buffers of the CRTC, they only change size with the mode */
+static CcmSessionRamp *
+ccm_session_get_ramp (CsdColorState *state, GnomeRRCrtc *crtc, guint size)
+{
+        CcmSessionRamp *ramp;
+        gpointer key = GUINT_TO_POINTER (gnome_rr_crtc_get_id (crtc));
+
+        ramp = g_hash_table_lookup (state->crtc_ramps, key);
+        if (ramp == NULL) {
+                ramp = g_new0 (CcmSessionRamp, 1);
+                g_hash_table_insert (state->crtc_ramps, key, ramp);
+        }
+        if (ramp->size != size) {
+                ramp->fingerprint_valid = FALSE;
+                g_free (ramp->red);
+                ramp->size = size;
+                ramp->red = g_new (guint16, size * 3);
+                ramp->green = ramp->red + size;
+                ramp->blue = ramp->green + size;
+        }
+        return ramp;
+}
+
+/* interpolate the white point from the table generated at build time */
+static void
+ccm_session_get_blackbody_rgb (guint temperature, CdColorRGB *result)
+{
+        const gfloat *lo;
+        const gfloat *hi;
+        gfloat alpha;
+        guint offset;
+        guint idx;
+
+        temperature = CLAMP (temperature,
+                             BLACKBODY_TEMPERATURE_MIN,
+                             BLACKBODY_TEMPERATURE_MAX);
+        offset = temperature - BLACKBODY_TEMPERATURE_MIN;
+        idx = offset / BLACKBODY_TEMPERATURE_STEP;
+        alpha = (gfloat) (offset % BLACKBODY_TEMPERATURE_STEP) / BLACKBODY_TEMPERATURE_STEP;
+
+        lo = blackbody_rgb_list[idx];
+        hi = blackbody_rgb_list[MIN (idx + 1, G_N_ELEMENTS (blackbody_rgb_list) - 1)];
+        cd_color_rgb_set (result,
+                          lo[0] + alpha * (hi[0] - lo[0]),
+                          lo[1] + alpha * (hi[1] - lo[1]),
+                          lo[2] + alpha * (hi[2] - lo[2]));
+}
+
+/* FNV-1a over all three channels, which share one allocation */
+static guint32
+ccm_session_ramp_fingerprint (const CcmSessionRamp *ramp)
+{
+        guint32 hash = 2166136261u;
+        guint i;
+
+        for (i = 0; i < ramp->size * 3; i++)
+                hash = (hash ^ ramp->red[i]) * 16777619u;
+        return hash;
+}
+
+/* the server may have reset the gamma, e.g. after a mode set */
+static void
+ccm_session_ramps_invalidate (CsdColorState *state)
+{
+        GHashTableIter iter;
+        CcmSessionRamp *ramp;
+
+        g_hash_table_iter_init (&iter, state->crtc_ramps);
+        while (g_hash_table_iter_next (&iter, NULL, (gpointer *) &ramp))
+                ramp->fingerprint_valid = FALSE;
+}
+
+/* a plain loop over contiguous memory, which the compiler vectorises */
+static void
+ccm_session_ramp_scale (guint16 *out, const gfloat *in, gfloat scale, guint size)
+{
+        guint i;
+
+        for (i = 0; i < size; i++)
+                out[i] = (guint16) MIN (in[i] * scale, (gfloat) 0xffff);
+}
+
 static gboolean
-ccm_session_output_set_gamma (GnomeRROutput *output,
-                              GPtrArray *array,
+ccm_session_output_set_gamma (CsdColorState *state,
+                              GnomeRROutput *output,
+                              const CcmSessionVcgt *vcgt,
+                              guint color_temperature,
                               GError **error)
 {
-        gboolean ret = TRUE;
-        guint16 *red = NULL;
-        guint16 *green = NULL;
-        guint16 *blue = NULL;
-        guint i;
-        GnomeRROutputClutItem *data;
+        CcmSessionRamp *ramp;
         GnomeRRCrtc *crtc;
+        CdColorRGB temp;
+        guint32 fingerprint;
 
         /* no length? */
-        if (array->len == 0) {
-                ret = FALSE;
+        if (vcgt->size == 0) {
                 g_set_error_literal (error,
                                      CSD_COLOR_MANAGER_ERROR,
                                      CSD_COLOR_MANAGER_ERROR_FAILED,
                                      "no data in the CLUT array");
-                goto out;
-        }
-
-        /* convert to a type X understands */
-        red = g_new (guint16, array->len);
-        green = g_new (guint16, array->len);
-        blue = g_new (guint16, array->len);
-        for (i = 0; i < array->len; i++) {
-                data = g_ptr_array_index (array, i);
-                red[i] = data->red;
-                green[i] = data->green;
-                blue[i] = data->blue;
+                return FALSE;
         }
 
-        /* send to LUT */
         crtc = gnome_rr_output_get_crtc (output);
         if (crtc == NULL) {
-                ret = FALSE;
                 g_set_error (error,
                              CSD_COLOR_MANAGER_ERROR,
                              CSD_COLOR_MANAGER_ERROR_FAILED,
                              "failed to get ctrc for %s",
                              gnome_rr_output_get_name (output));
-                goto out;
+                return FALSE;
         }
-        gnome_rr_crtc_set_gamma (crtc, array->len,
-                                 red, green, blue);
-out:
-        g_free (red);
-        g_free (green);
-        g_free (blue);
-        return ret;
+
+        /* get the color temperature */
+        ccm_session_get_blackbody_rgb (color_temperature, &temp);
+        g_debug ("using gamma of %uK = %.1f,%.1f,%.1f",
+                 color_temperature, temp.R, temp.G, temp.B);
+
+        /* convert to a type X understands */
+        ramp = ccm_session_get_ramp (state, crtc, vcgt->size);
+        ccm_session_ramp_scale (ramp->red, vcgt->red, temp.R * 0xffff, ramp->size);
+        ccm_session_ramp_scale (ramp->green, vcgt->green, temp.G * 0xffff, ramp->size);
+        ccm_session_ramp_scale (ramp->blue, vcgt->blue, temp.B * 0xffff, ramp->size);
+
+        /* small temperature steps often quantise to the same ramp */
+        fingerprint = ccm_session_ramp_fingerprint (ramp);
+        if (ramp->fingerprint_valid && ramp->fingerprint == fingerprint) {
+                g_debug ("gamma of %s unchanged, not setting",
+                         gnome_rr_output_get_name (output));
+                return TRUE;
+        }
+        ramp->fingerprint = fingerprint;
+        ramp->fingerprint_valid = TRUE;
+
+        /* send to LUT */
+        gnome_rr_crtc_set_gamma (crtc, ramp->size,
+                                 ramp->red, ramp->green, ramp->blue);
+        return TRUE;
 }
 
 static gboolean
-ccm_session_device_set_gamma (GnomeRROutput *output,
+ccm_session_device_set_gamma (CsdColorState *state,
+                              GnomeRROutput *output,
                               CdProfile *profile,
                               guint color_temperature,
                               GError **error)
 {
-        gboolean ret = FALSE;
+        CcmSessionVcgt *vcgt;
+        CcmSessionVcgt *vcgt_uncached = NULL;
+        gboolean ret;
         guint size;
-        GPtrArray *clut = NULL;
 
         /* create a lookup table */
         size = gnome_rr_output_get_gamma_size (output);
-        if (size == 0) {
-                ret = TRUE;
-                goto out;
-        }
-        clut = ccm_session_generate_vcgt (profile, color_temperature, size);
-        if (clut == NULL) {
+        if (size == 0)
+                return TRUE;
+
+        /* a profile with neither checksum nor file has nothing to key on */
+        if (ccm_session_get_vcgt_key (profile) != NULL)
+                vcgt = ccm_session_get_vcgt (state, profile, size);
+        else
+                vcgt = vcgt_uncached = ccm_session_vcgt_new (profile, size);
+        if (vcgt == NULL) {
                 g_set_error_literal (error,
                                      CSD_COLOR_MANAGER_ERROR,
                                      CSD_COLOR_MANAGER_ERROR_FAILED,
                                      "failed to generate vcgt");
-                goto out;
+                return FALSE;
         }
 
         /* apply the vcgt to this output */
-        ret = ccm_session_output_set_gamma (output, clut, error);
-        if (!ret)
-                goto out;
-out:
-        if (clut != NULL)
-                g_ptr_array_unref (clut);
+        ret = ccm_session_output_set_gamma (state, output, vcgt, color_temperature, error);
+        if (vcgt_uncached != NULL)
+                ccm_session_vcgt_free (vcgt_uncached);
         return ret;
 }
 
 static gboolean
-ccm_session_device_reset_gamma (GnomeRROutput *output,
+ccm_session_device_reset_gamma (CsdColorState *state,
+                                GnomeRROutput *output,
                                 guint color_temperature,
                                 GError **error)
 {
-        gboolean ret;
-        guint i;
+        CcmSessionVcgt *vcgt;
         guint size;
-        guint32 value;
-        GPtrArray *clut;
-        GnomeRROutputClutItem *data;
-        CdColorRGB temp;
 
         /* create a linear ramp */
         g_debug ("falling back to dummy ramp");
-        clut = g_ptr_array_new_with_free_func (g_free);
         size = gnome_rr_output_get_gamma_size (output);
-        if (size == 0) {
-                ret = TRUE;
-                goto out;
-        }
-
-        /* get the color temperature */
-        if (!cd_color_get_blackbody_rgb_full (color_temperature,
-                                              &temp,
-                                              CD_COLOR_BLACKBODY_FLAG_USE_PLANCKIAN)) {
-                g_warning ("failed to get blackbody for %uK", color_temperature);
-                cd_color_rgb_set (&temp, 1.0, 1.0, 1.0);
-        } else {
-                g_debug ("using reset gamma of %uK = %.1f,%.1f,%.1f",
-                         color_temperature, temp.R, temp.G, temp.B);
-        }
-
-        for (i = 0; i < size; i++) {
-                value = (i * 0xffff) / (size - 1);
-                data = g_new0 (GnomeRROutputClutItem, 1);
-                data->red = value * temp.R;
-                data->green = value * temp.G;
-                data->blue = value * temp.B;
-                g_ptr_array_add (clut, data);
-        }
+        if (size == 0)
+                return TRUE;
+        vcgt = ccm_session_get_linear_vcgt (state, size);
 
-        /* apply the vcgt to this output */
-        ret = ccm_session_output_set_gamma (output, clut, error);
-        if (!ret)
-                goto out;
-out:
-        g_ptr_array_unref (clut);
-        return ret;
+        /* apply the ramp to this output */
+        return ccm_session_output_set_gamma (state, output, vcgt, color_temperature, error);
 }
 
 static GnomeRROutput *
@@ -814,10 +1037,14 @@ ccm_session_device_assign_profile_connect_cb (GObject *object,
                 }
         }
 
+        /* remember for the next temperature change */
+        ccm_session_output_device_set (state, output, helper->device, profile);
+
         /* create a vcgt for this icc file */
         ret = cd_profile_get_has_vcgt (profile);
         if (ret) {
-                ret = ccm_session_device_set_gamma (output,
+                ret = ccm_session_device_set_gamma (state,
+                                                    output,
                                                     profile,
                                                     state->color_temperature,
                                                     &error);
@@ -829,7 +1056,8 @@ ccm_session_device_assign_profile_connect_cb (GObject *object,
                         goto out;
                 }
         } else {
-                ret = ccm_session_device_reset_gamma (output,
+                ret = ccm_session_device_reset_gamma (state,
+                                                      output,
                                                       state->color_temperature,
                                                       &error);
                 if (!ret) {
@@ -844,6 +1072,77 @@ out:
         ccm_session_async_helper_free (helper);
 }
 
+/*
+ * The index of auto-generated profiles lives in the cache directory and
+ * is keyed by the EDID checksum. An entry records the profile path and
+ * the mtime and size it had when it was last known to be good, so that
+ * on the next login we neither load nor regenerate an unchanged profile.
+ */
+static GKeyFile *
+ccm_session_profile_index_get (CsdColorState *state)
+{
+        g_autoptr(GError) error = NULL;
+
+        if (state->profile_index != NULL)
+                return state->profile_index;
+
+        state->profile_index_path = g_build_filename (g_get_user_cache_dir (),
+                                                      "cinnamon-settings-daemon",
+                                                      "edid-profiles.ini",
+                                                      NULL);
+        state->profile_index = g_key_file_new ();
+        if (!g_key_file_load_from_file (state->profile_index,
+                                        state->profile_index_path,
+                                        G_KEY_FILE_NONE,
+                                        &error)) {
+                if (!g_error_matches (error, G_FILE_ERROR, G_FILE_ERROR_NOENT))
+                        g_warning ("failed to load %s: %s",
+                                   state->profile_index_path, error->message);
+        }
+        return state->profile_index;
+}
+
+static gboolean
+ccm_session_profile_index_lookup (CsdColorState *state,
+                                  const gchar *checksum,
+                                  const gchar *filename)
+{
+        GKeyFile *index = ccm_session_profile_index_get (state);
+        g_autofree gchar *profile = NULL;
+        GStatBuf buf;
+
+        profile = g_key_file_get_string (index, checksum, "Profile", NULL);
+        if (g_strcmp0 (profile, filename) != 0)
+                return FALSE;
+        if (g_stat (filename, &buf) != 0)
+                return FALSE;
+        return g_key_file_get_uint64 (index, checksum, "Mtime", NULL) == (guint64) buf.st_mtime &&
+               g_key_file_get_uint64 (index, checksum, "Size", NULL) == (guint64) buf.st_size;
+}
+
+static void
+ccm_session_profile_index_update (CsdColorState *state,
+                                  const gchar *checksum,
+                                  const gchar *filename)
+{
+        GKeyFile *index = ccm_session_profile_index_get (state);
+        g_autofree gchar *dirname = NULL;
+        g_autoptr(GError) error = NULL;
+        GStatBuf buf;
+
+        if (g_stat (filename, &buf) != 0)
+                return;
+        g_key_file_set_string (index, checksum, "Profile", filename);
+        g_key_file_set_uint64 (index, checksum, "Mtime", buf.st_mtime);
+        g_key_file_set_uint64 (index, checksum, "Size", buf.st_size);
+
+        dirname = g_path_get_dirname (state->profile_index_path);
+        g_mkdir_with_parents (dirname, 0755);
+        if (!g_key_file_save_to_file (index, state->profile_index_path, &error))
+                g_warning ("failed to save %s: %s",
+                           state->profile_index_path, error->message);
+}
+
 /*
  * Check to see if the on-disk profile has the MAPPING_device_id
  * metadata, and if not, we should delete the profile and re-create it
@@ -939,8 +1238,15 @@ ccm_session_device_assign_connect_cb (GObject *object,
 
                 /* check if auto-profile has up-to-date metadata */
                 file = g_file_new_for_path (autogen_path);
-                if (ccm_session_check_profile_device_md (file)) {
+                if (ccm_session_profile_index_lookup (state,
+                                                      ccm_edid_get_checksum (edid),
+                                                      autogen_path)) {
+                        g_debug ("auto-profile edid %s is unchanged", autogen_path);
+                } else if (ccm_session_check_profile_device_md (file)) {
                         g_debug ("auto-profile edid %s exists with md", autogen_path);
+                        ccm_session_profile_index_update (state,
+                                                          ccm_edid_get_checksum (edid),
+                                                          autogen_path);
                 } else {
                         g_debug ("auto-profile edid does not exist, creating as %s",
                                  autogen_path);
@@ -962,6 +1268,10 @@ ccm_session_device_assign_connect_cb (GObject *object,
                                 g_warning ("failed to create profile from EDID data: %s",
                                              error->message);
                                 g_clear_error (&error);
+                        } else {
+                                ccm_session_profile_index_update (state,
+                                                                  ccm_edid_get_checksum (edid),
+                                                                  autogen_path);
                         }
                 }
         }
@@ -981,8 +1291,11 @@ ccm_session_device_assign_connect_cb (GObject *object,
                                              gdk_atom_intern_static_string ("_ICC_PROFILE_IN_X_VERSION"));
                 }
 
+                ccm_session_output_device_set (state, output, device, NULL);
+
                 /* reset, as we want linear profiles for profiling */
-                ret = ccm_session_device_reset_gamma (output,
+                ret = ccm_session_device_reset_gamma (state,
+                                                      output,
                                                       state->color_temperature,
                                                       &error);
                 if (!ret) {
@@ -1051,9 +1364,18 @@ ccm_session_device_changed_assign_cb (CdClient *client,
                                       CsdColorState *state)
 {
         g_debug ("%s changed", cd_device_get_object_path (device));
+        ccm_session_output_device_invalidate (state, device);
         ccm_session_device_assign (state, device);
 }
 
+static void
+ccm_session_device_removed_cb (CdClient *client,
+                               CdDevice *device,
+                               CsdColorState *state)
+{
+        ccm_session_output_device_invalidate (state, device);
+}
+
 static void
 ccm_session_create_device_cb (GObject *object,
                               GAsyncResult *res,
@@ -1247,6 +1569,8 @@ gnome_rr_screen_output_removed_cb (GnomeRRScreen *screen,
                  gnome_rr_output_get_name (output));
         g_hash_table_remove (state->edid_cache,
                              gnome_rr_output_get_name (output));
+        g_hash_table_remove (state->output_devices,
+                             gnome_rr_output_get_name (output));
         cd_client_find_device_by_property (state->client,
                                            CD_DEVICE_METADATA_XRANDR_NAME,
                                            gnome_rr_output_get_name (output),
@@ -1310,9 +1634,40 @@ ccm_session_profile_gamma_find_device_cb (GObject *object,
                 g_object_unref (device);
 }
 
+/* apply the temperature to an output colord has already told us about */
+static void
+ccm_session_output_device_set_gamma (CsdColorState *state,
+                                     GnomeRROutput *output,
+                                     CcmSessionOutputDevice *output_device)
+{
+        gboolean ret;
+        GError *error = NULL;
+
+        if (output_device->profile != NULL &&
+            cd_profile_get_has_vcgt (output_device->profile)) {
+                ret = ccm_session_device_set_gamma (state,
+                                                    output,
+                                                    output_device->profile,
+                                                    state->color_temperature,
+                                                    &error);
+        } else {
+                ret = ccm_session_device_reset_gamma (state,
+                                                      output,
+                                                      state->color_temperature,
+                                                      &error);
+        }
+        if (!ret) {
+                g_warning ("failed to set %s gamma tables: %s",
+                           cd_device_get_id (output_device->device),
+                           error->message);
+                g_error_free (error);
+        }
+}
+
 static void
 ccm_session_set_gamma_for_all_devices (CsdColorState *state)
 {
+        CcmSessionOutputDevice *output_device;
         GnomeRROutput **outputs;
         guint i;
 
@@ -1328,6 +1683,13 @@ ccm_session_set_gamma_for_all_devices (CsdColorState *state)
                 return;
         }
         for (i = 0; outputs[i] != NULL; i++) {
+                output_device = g_hash_table_lookup (state->output_devices,
+                                                     gnome_rr_output_get_name (outputs[i]));
+                if (output_device != NULL) {
+                        ccm_session_output_device_set_gamma (state, outputs[i], output_device);
+                        continue;
+                }
+
                 /* get CdDevice for this output */
                 cd_client_find_device_by_property (state->client,
                                                    CD_DEVICE_METADATA_XRANDR_NAME,
@@ -1345,6 +1707,7 @@ static void
 gnome_rr_screen_output_changed_cb (GnomeRRScreen *screen,
                                    CsdColorState *state)
 {
+        ccm_session_ramps_invalidate (state);
         ccm_session_set_gamma_for_all_devices (state);
 }
 
@@ -1390,6 +1753,7 @@ ccm_session_active_changed_cb (GDBusProxy      *session,
          */
         if (is_active && !state->session_is_active) {
                 g_debug ("Done switch to new account, reload devices");
+                ccm_session_ramps_invalidate (state);
                 cd_client_get_devices (state->client,
                                        state->cancellable,
                                        ccm_session_get_devices_cb,
@@ -1465,6 +1829,15 @@ ccm_session_client_connect_cb (GObject *source_object,
         g_signal_connect (state->client, "device-changed",
                           G_CALLBACK (ccm_session_device_changed_assign_cb),
                           state);
+        g_signal_connect (state->client, "device-removed",
+                          G_CALLBACK (ccm_session_device_removed_cb),
+                          state);
+        g_signal_connect (state->client, "profile-changed",
+                          G_CALLBACK (ccm_session_profile_changed_cb),
+                          state);
+        g_signal_connect (state->client, "profile-removed",
+                          G_CALLBACK (ccm_session_profile_changed_cb),
+                          state);
 
         /* set for each device that already exist */
         cd_client_get_devices (state->client,
@@ -1561,6 +1934,24 @@ csd_color_state_init (CsdColorState *state)
                                                           g_free,
                                                           NULL);
 
+        /* sampled VCGT curves, keyed by the profile checksum */
+        state->vcgt_cache = g_hash_table_new_full (g_str_hash,
+                                                  g_str_equal,
+                                                  g_free,
+                                                  (GDestroyNotify) ccm_session_vcgt_free);
+
+        /* colord devices and profiles, keyed by the output name */
+        state->output_devices = g_hash_table_new_full (g_str_hash,
+                                                      g_str_equal,
+                                                      g_free,
+                                                      (GDestroyNotify) ccm_session_output_device_free);
+
+        /* gamma ramp buffers, keyed by the CRTC id */
+        state->crtc_ramps = g_hash_table_new_full (g_direct_hash,
+                                                  g_direct_equal,
+                                                  NULL,
+                                                  (GDestroyNotify) ccm_session_ramp_free);
+
         /* default color temperature */
         state->color_temperature = CSD_COLOR_TEMPERATURE_DEFAULT;
 
@@ -1582,7 +1973,13 @@ csd_color_state_finalize (GObject *object)
         g_clear_object (&state->client);
         g_clear_object (&state->session);
         g_clear_pointer (&state->edid_cache, g_hash_table_destroy);
+        g_clear_pointer (&state->profile_index, g_key_file_unref);
+        g_clear_pointer (&state->profile_index_path, g_free);
         g_clear_pointer (&state->device_assign_hash, g_hash_table_destroy);
+        g_clear_pointer (&state->vcgt_cache, g_hash_table_destroy);
+        g_clear_pointer (&state->output_devices, g_hash_table_destroy);
+        g_clear_pointer (&state->crtc_ramps, g_hash_table_destroy);
+        g_clear_pointer (&state->linear_vcgt, ccm_session_vcgt_free);
         g_clear_object (&state->state_screen);
 
         G_OBJECT_CLASS (csd_color_state_parent_class)->finalize (object);
@@ -36,29 +36,34 @@ rad2deg (gdouble radians)
         return radians * (180.f / M_PI);
 }
 
+/* the result only depends on the day, the place and the UTC offset, and
+ * the schedule asks again for the same values all day long */
+#define SUNRISE_SUNSET_MEMO_SIZE        4
+#define SUNRISE_SUNSET_MEMO_PRECISION   10000   /* 1/10000 degree */
+
+typedef struct {
+        gboolean         valid;
+        gint64           days;
+        gint32           pos_lat;
+        gint32           pos_long;
+        GTimeSpan        utc_offset;
+        gdouble          sunrise;
+        gdouble          sunset;
+} SunriseSunsetMemo;
+
+static SunriseSunsetMemo sunrise_sunset_memo[SUNRISE_SUNSET_MEMO_SIZE];
+static guint sunrise_sunset_memo_next = 0;
+
 /*
  * Formulas taken from https://www.esrl.noaa.gov/gmd/grad/solcalc/calcdetails.html
- *
- * The returned values are fractional hours, so 6am would be 6.0 and 4:30pm
- * would be 16.5.
- *
- * The values returned by this function might not make sense for locations near
- * the polar regions. For example, in the north of Lapland there might not be
- * a sunrise at all.
  */
-gboolean
-csd_night_light_get_sunrise_sunset (GDateTime *dt,
-                                    gdouble pos_lat, gdouble pos_long,
-                                    gdouble *sunrise, gdouble *sunset)
+static void
+get_sunrise_sunset_for_day (gint64 days, GTimeSpan utc_offset,
+                            gdouble pos_lat, gdouble pos_long,
+                            gdouble *sunrise, gdouble *sunset)
 {
-        g_autoptr(GDateTime) dt_zero = g_date_time_new_utc (1900, 1, 1, 0, 0, 0);
-        GTimeSpan ts = g_date_time_difference (dt, dt_zero);
-
-        g_return_val_if_fail (pos_lat <= 90.f && pos_lat >= -90.f, FALSE);
-        g_return_val_if_fail (pos_long <= 180.f && pos_long >= -180.f, FALSE);
-
-        gdouble tz_offset = (gdouble) g_date_time_get_utc_offset (dt) / G_USEC_PER_SEC / 60 / 60; // B5
-        gdouble date_as_number = ts / G_USEC_PER_SEC / 24 / 60 / 60 + 2;  // B7
+        gdouble tz_offset = (gdouble) utc_offset / G_USEC_PER_SEC / 60 / 60; // B5
+        gdouble date_as_number = days + 2;  // B7
         gdouble time_past_local_midnight = 0;  // E2, unused in this calculation
         gdouble julian_day = date_as_number + 2415018.5 +
                         time_past_local_midnight - tz_offset / 24;
@@ -99,10 +104,69 @@ csd_night_light_get_sunrise_sunset (GDateTime *dt,
         gdouble sunset_time = solar_noon + ha_sunrise * 4 / 1440; // Z2
 
         /* convert to hours */
+        *sunrise = sunrise_time * 24;
+        *sunset = sunset_time * 24;
+}
+
+/*
+ * The returned values are fractional hours, so 6am would be 6.0 and 4:30pm
+ * would be 16.5.
+ *
+ * The values returned by this function might not make sense for locations near
+ * the polar regions. For example, in the north of Lapland there might not be
+ * a sunrise at all.
+ */
+gboolean
+csd_night_light_get_sunrise_sunset (GDateTime *dt,
+                                    gdouble pos_lat, gdouble pos_long,
+                                    gdouble *sunrise, gdouble *sunset)
+{
+        g_autoptr(GDateTime) dt_zero = g_date_time_new_utc (1900, 1, 1, 0, 0, 0);
+        GTimeSpan ts = g_date_time_difference (dt, dt_zero);
+        SunriseSunsetMemo *memo = NULL;
+        GTimeSpan utc_offset;
+        gint32 key_lat;
+        gint32 key_long;
+        gint64 days;
+        guint i;
+
+        g_return_val_if_fail (pos_lat <= 90.f && pos_lat >= -90.f, FALSE);
+        g_return_val_if_fail (pos_long <= 180.f && pos_long >= -180.f, FALSE);
+
+        days = ts / G_USEC_PER_SEC / 24 / 60 / 60;
+        utc_offset = g_date_time_get_utc_offset (dt);
+        key_lat = (gint32) round (pos_lat * SUNRISE_SUNSET_MEMO_PRECISION);
+        key_long = (gint32) round (pos_long * SUNRISE_SUNSET_MEMO_PRECISION);
+
+        for (i = 0; i < SUNRISE_SUNSET_MEMO_SIZE; i++) {
+                SunriseSunsetMemo *tmp = &sunrise_sunset_memo[i];
+                if (tmp->valid &&
+                    tmp->days == days &&
+                    tmp->pos_lat == key_lat &&
+                    tmp->pos_long == key_long &&
+                    tmp->utc_offset == utc_offset) {
+                        memo = tmp;
+                        break;
+                }
+        }
+
+        /* not seen recently, replace the oldest entry */
+        if (memo == NULL) {
+                memo = &sunrise_sunset_memo[sunrise_sunset_memo_next];
+                sunrise_sunset_memo_next = (sunrise_sunset_memo_next + 1) % SUNRISE_SUNSET_MEMO_SIZE;
+                get_sunrise_sunset_for_day (days, utc_offset, pos_lat, pos_long,
+                                            &memo->sunrise, &memo->sunset);
+                memo->days = days;
+                memo->pos_lat = key_lat;
+                memo->pos_long = key_long;
+                memo->utc_offset = utc_offset;
+                memo->valid = TRUE;
+        }
+
         if (sunrise != NULL)
-                *sunrise = sunrise_time * 24;
+                *sunrise = memo->sunrise;
         if (sunset != NULL)
-                *sunset = sunset_time * 24;
+                *sunset = memo->sunset;
         return TRUE;
 }
 
@@ -20,6 +20,10 @@
 
 #include "config.h"
 
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
 #define GNOME_DESKTOP_USE_UNSTABLE_API
 #include "gnome-datetime-source.h"
 
@@ -36,6 +40,8 @@ struct _CsdNightLight {
         gboolean           disabled_until_tmw;
         GDateTime         *disabled_until_tmw_dt;
         GSource           *source;
+        gboolean           running;
+        gdouble            next_recheck;        /* hours from now, or < 0 */
         guint              validate_id;
         gdouble            cached_sunrise;
         gdouble            cached_sunset;
@@ -44,6 +50,7 @@ struct _CsdNightLight {
         gboolean           smooth_enabled;
         GTimer            *smooth_timer;
         guint              smooth_id;
+        gdouble            smooth_start_temperature;
         gdouble            smooth_target_temperature;
         GCancellable      *cancellable;
         GDateTime         *datetime_override;
@@ -67,9 +74,11 @@ enum {
 };
 
 #define CSD_NIGHT_LIGHT_SCHEDULE_TIMEOUT      5       /* seconds */
-#define CSD_NIGHT_LIGHT_POLL_TIMEOUT          60      /* seconds */
+#define CSD_NIGHT_LIGHT_POLL_TIMEOUT          60      /* seconds, while smearing */
 #define CSD_NIGHT_LIGHT_POLL_SMEAR            1       /* hours */
 #define CSD_NIGHT_LIGHT_SMOOTH_SMEAR          5.f     /* seconds */
+#define CSD_NIGHT_LIGHT_SMOOTH_INTERVAL_MIN   50      /* ms */
+#define CSD_NIGHT_LIGHT_SMOOTH_INTERVAL_MAX   1000    /* ms */
 
 #define CSD_FRAC_DAY_MAX_DELTA                  (1.f/60.f)     /* 1 minute */
 #define CSD_TEMPERATURE_MAX_DELTA               (10.f)          /* Kelvin */
@@ -179,38 +188,85 @@ csd_night_light_set_temperature_internal (CsdNightLight *self, gdouble temperatu
         g_object_notify (G_OBJECT (self), "temperature");
 }
 
+/* the fraction of the delta still left after @elapsed seconds; this is the
+ * curve a fixed CSD_NIGHT_LIGHT_SMOOTH_INTERVAL_MIN tick moving elapsed/smear
+ * of the way each time produces, in closed form so it does not depend on how
+ * often we actually tick */
+static gdouble
+csd_night_light_smooth_remaining (gdouble elapsed)
+{
+        gdouble left;
+
+        if (elapsed >= CSD_NIGHT_LIGHT_SMOOTH_SMEAR)
+                return 0.f;
+        left = CSD_NIGHT_LIGHT_SMOOTH_SMEAR - elapsed;
+        return exp ((-left * log (left / CSD_NIGHT_LIGHT_SMOOTH_SMEAR) - elapsed) /
+                    (CSD_NIGHT_LIGHT_SMOOTH_INTERVAL_MIN / 1000.f));
+}
+
+static gdouble
+csd_night_light_smooth_temperature (CsdNightLight *self, gdouble elapsed)
+{
+        gdouble tmp;
+
+        tmp = self->smooth_start_temperature - self->smooth_target_temperature;
+        tmp *= csd_night_light_smooth_remaining (elapsed);
+        return tmp + self->smooth_target_temperature;
+}
+
+/* tick when the curve next moves a visible step away from the current
+ * temperature, in whole CSD_NIGHT_LIGHT_SMOOTH_INTERVAL_MIN steps */
+static guint
+csd_night_light_smooth_interval (CsdNightLight *self)
+{
+        gdouble elapsed;
+        gdouble tmp;
+        guint interval;
+
+        elapsed = g_timer_elapsed (self->smooth_timer, NULL);
+        for (interval = CSD_NIGHT_LIGHT_SMOOTH_INTERVAL_MIN;
+             interval < CSD_NIGHT_LIGHT_SMOOTH_INTERVAL_MAX;
+             interval += CSD_NIGHT_LIGHT_SMOOTH_INTERVAL_MIN) {
+                tmp = csd_night_light_smooth_temperature (self, elapsed + interval / 1000.f);
+                if (ABS (tmp - self->cached_temperature) > CSD_TEMPERATURE_MAX_DELTA)
+                        break;
+        }
+        return interval;
+}
+
 static gboolean
 csd_night_light_smooth_cb (gpointer user_data)
 {
         CsdNightLight *self = CSD_NIGHT_LIGHT (user_data);
-        gdouble tmp;
-        gdouble frac;
+        gdouble elapsed;
 
-        /* find fraction */
-        frac = g_timer_elapsed (self->smooth_timer, NULL) / CSD_NIGHT_LIGHT_SMOOTH_SMEAR;
-        if (frac >= 1.f) {
+        elapsed = g_timer_elapsed (self->smooth_timer, NULL);
+        if (elapsed >= CSD_NIGHT_LIGHT_SMOOTH_SMEAR) {
                 csd_night_light_set_temperature_internal (self,
                                                           self->smooth_target_temperature);
                 self->smooth_id = 0;
                 return G_SOURCE_REMOVE;
         }
 
-        /* set new temperature step using log curve */
-        tmp = self->smooth_target_temperature - self->cached_temperature;
-        tmp *= frac;
-        tmp += self->cached_temperature;
-        csd_night_light_set_temperature_internal (self, tmp);
+        /* follow the curve from where the transition started */
+        csd_night_light_set_temperature_internal (self,
+                                                  csd_night_light_smooth_temperature (self, elapsed));
 
-        return G_SOURCE_CONTINUE;
+        /* re-arm at the rate the curve needs */
+        self->smooth_id = g_timeout_add (csd_night_light_smooth_interval (self),
+                                         csd_night_light_smooth_cb, self);
+        return G_SOURCE_REMOVE;
 }
 
 static void
 poll_smooth_create (CsdNightLight *self, gdouble temperature)
 {
         g_assert (self->smooth_id == 0);
+        self->smooth_start_temperature = self->cached_temperature;
         self->smooth_target_temperature = temperature;
         self->smooth_timer = g_timer_new ();
-        self->smooth_id = g_timeout_add (50, csd_night_light_smooth_cb, self);
+        self->smooth_id = g_timeout_add (csd_night_light_smooth_interval (self),
+                                         csd_night_light_smooth_cb, self);
 }
 
 static void
@@ -249,9 +305,26 @@ csd_night_light_set_active (CsdNightLight *self, gboolean active)
         g_object_notify (G_OBJECT (self), "active");
 }
 
+/* keep the earliest point at which the schedule has to be looked at again,
+ * a second after the event so that the range checks see it has passed */
 static void
-night_light_recheck (CsdNightLight *self)
+night_light_add_deadline (gdouble *next, gdouble frac_day, gdouble frac_event)
+{
+        gdouble delta = fmod (frac_event - frac_day, 24);
+
+        if (delta <= 0)
+                delta += 24;
+        delta += 1.f / 3600.f;
+        if (*next < 0 || delta < *next)
+                *next = delta;
+}
+
+/* returns the hours until the temperature can next change, or -1 if only
+ * a settings change can change it */
+static gdouble
+night_light_update (CsdNightLight *self)
 {
+        gdouble next = -1.f;
         gdouble frac_day;
         gdouble schedule_from = -1.f;
         gdouble schedule_to = -1.f;
@@ -265,14 +338,14 @@ night_light_recheck (CsdNightLight *self)
         if (self->forced) {
                 temperature = g_settings_get_uint (self->settings, "night-light-temperature");
                 csd_night_light_set_temperature (self, temperature);
-                return;
+                return -1.f;
         }
 
         /* enabled */
         if (!g_settings_get_boolean (self->settings, "night-light-enabled")) {
                 g_debug ("night light disabled, resetting");
                 csd_night_light_set_active (self, FALSE);
-                return;
+                return -1.f;
         }
 
         /* schedule-mode */
@@ -284,7 +357,7 @@ night_light_recheck (CsdNightLight *self)
                          temperature);
                 csd_night_light_set_active (self, TRUE);
                 csd_night_light_set_temperature (self, temperature);
-                return;
+                return -1.f;
         case NIGHT_LIGHT_SCHEDULE_AUTO:
                 /* calculate the position of the sun */
                 update_cached_sunrise_sunset (self);
@@ -310,6 +383,17 @@ night_light_recheck (CsdNightLight *self)
         g_debug ("fractional day = %.3f, limits = %.3f->%.3f",
                  frac_day, schedule_from, schedule_to);
 
+        /* lower smearing period to be smaller than the time between start/stop */
+        smear = MIN (smear,
+                     MIN (     ABS (schedule_to - schedule_from),
+                          24 - ABS (schedule_to - schedule_from)));
+
+        /* the temperature only changes at, and in between, these */
+        night_light_add_deadline (&next, frac_day, schedule_from - smear);
+        night_light_add_deadline (&next, frac_day, schedule_from);
+        night_light_add_deadline (&next, frac_day, schedule_to - smear);
+        night_light_add_deadline (&next, frac_day, schedule_to);
+
         /* disabled until tomorrow */
         if (self->disabled_until_tmw) {
                 GTimeSpan time_span;
@@ -342,21 +426,20 @@ night_light_recheck (CsdNightLight *self)
                         g_debug ("night light still day-disabled, resetting");
                         csd_night_light_set_temperature (self,
                                                          CSD_COLOR_TEMPERATURE_DEFAULT);
-                        return;
+
+                        /* sunrise is already a deadline, add the 24h expiry */
+                        if (time_span > 0)
+                                next = MIN (next, 24 - (gdouble) time_span / G_USEC_PER_SEC / 3600);
+                        return next;
                 }
         }
 
-        /* lower smearing period to be smaller than the time between start/stop */
-        smear = MIN (smear,
-                     MIN (     ABS (schedule_to - schedule_from),
-                          24 - ABS (schedule_to - schedule_from)));
-
         if (!csd_night_light_frac_day_is_between (frac_day,
                                                   schedule_from - smear,
                                                   schedule_to)) {
                 g_debug ("not time for night-light");
                 csd_night_light_set_active (self, FALSE);
-                return;
+                return next;
         }
 
         /* smear the temperature for a short duration before the set limits
@@ -379,12 +462,14 @@ night_light_recheck (CsdNightLight *self)
                 gdouble factor = 1.f - ((frac_day - (schedule_from - smear)) / smear);
                 temp_smeared = linear_interpolate (CSD_COLOR_TEMPERATURE_DEFAULT,
                                                    temperature, factor);
+                next = MIN (next, CSD_NIGHT_LIGHT_POLL_TIMEOUT / 3600.f);
         } else if (csd_night_light_frac_day_is_between (frac_day,
                                                         schedule_to - smear,
                                                         schedule_to)) {
                 gdouble factor = (frac_day - (schedule_to - smear)) / smear;
                 temp_smeared = linear_interpolate (CSD_COLOR_TEMPERATURE_DEFAULT,
                                                    temperature, factor);
+                next = MIN (next, CSD_NIGHT_LIGHT_POLL_TIMEOUT / 3600.f);
         } else {
                 temp_smeared = temperature;
         }
@@ -392,6 +477,19 @@ night_light_recheck (CsdNightLight *self)
                  temp_smeared, temperature);
         csd_night_light_set_active (self, TRUE);
         csd_night_light_set_temperature (self, temp_smeared);
+        return next;
+}
+
+static void
+night_light_recheck (CsdNightLight *self)
+{
+        self->next_recheck = night_light_update (self);
+
+        /* the deadline may have moved */
+        if (self->running) {
+                poll_timeout_destroy (self);
+                poll_timeout_create (self);
+        }
 }
 
 /* called when the time may have changed */
@@ -400,10 +498,8 @@ night_light_recheck_cb (gpointer user_data)
 {
         CsdNightLight *self = CSD_NIGHT_LIGHT (user_data);
 
-        /* recheck parameters, then reschedule a new timeout */
+        /* recheck parameters, which also reschedules a new timeout */
         night_light_recheck (self);
-        poll_timeout_destroy (self);
-        poll_timeout_create (self);
 
         /* return value ignored for a one-time watch */
         return G_SOURCE_REMOVE;
@@ -413,13 +509,28 @@ static void
 poll_timeout_create (CsdNightLight *self)
 {
         g_autoptr(GDateTime) dt_now = NULL;
+        g_autoptr(GDateTime) dt_wall = NULL;
         g_autoptr(GDateTime) dt_expiry = NULL;
+        GTimeSpan offset_change;
 
         if (self->source != NULL)
                 return;
 
+        /* nothing to do until the settings change */
+        if (self->next_recheck < 0)
+                return;
+
+        /* the deadline is in wall clock hours, so allow for a DST change */
         dt_now = csd_night_light_get_date_time_now (self);
-        dt_expiry = g_date_time_add_seconds (dt_now, CSD_NIGHT_LIGHT_POLL_TIMEOUT);
+        dt_wall = g_date_time_add_seconds (dt_now, self->next_recheck * 3600);
+        offset_change = g_date_time_get_utc_offset (dt_wall) - g_date_time_get_utc_offset (dt_now);
+        if (self->next_recheck * 3600 > offset_change / G_USEC_PER_SEC)
+                dt_expiry = g_date_time_add (dt_wall, -offset_change);
+        else
+                dt_expiry = g_date_time_add_seconds (dt_now, CSD_NIGHT_LIGHT_POLL_TIMEOUT);
+
+        g_debug ("next night light recheck in %.0f seconds",
+                 (gdouble) g_date_time_difference (dt_expiry, dt_now) / G_USEC_PER_SEC);
         self->source = _gnome_datetime_source_new (dt_now,
                                                    dt_expiry,
                                                    TRUE);
@@ -449,24 +560,56 @@ settings_changed_cb (GSettings *settings, gchar *key, gpointer user_data)
         night_light_recheck (self);
 }
 
+static int
+tz_coords_compare (const void *key, const void *element)
+{
+    return strcmp (key, ((const TZCoords *) element)->timezone);
+}
+
+static int
+tz_alias_compare (const void *key, const void *element)
+{
+    return strcmp (key, ((const TZAlias *) element)->alias);
+}
+
+/* both generated lists are sorted by name */
+static const TZCoords *
+lookup_tz_coords (const gchar *id)
+{
+    const TZCoords *coords;
+    const TZAlias *alias;
+
+    if (id == NULL)
+        return NULL;
+
+    coords = bsearch (id, tz_coord_list, G_N_ELEMENTS (tz_coord_list),
+                      sizeof (TZCoords), tz_coords_compare);
+    if (coords != NULL)
+        return coords;
+
+    /* backward compatible names, e.g. Asia/Calcutta */
+    alias = bsearch (id, tz_alias_list, TZ_ALIAS_COUNT,
+                     sizeof (TZAlias), tz_alias_compare);
+    if (alias != NULL)
+        return &tz_coord_list[alias->index];
+
+    return NULL;
+}
+
 static void
 update_location_from_timezone (CsdNightLight *self)
 {
     GTimeZone *tz = g_time_zone_new_local ();
     const gchar *id = g_time_zone_get_identifier (tz);
+    const TZCoords *coords = lookup_tz_coords (id);
 
-    for (int i = 0; i < G_N_ELEMENTS (tz_coord_list); i++)
+    if (coords != NULL)
     {
-        const TZCoords coords = tz_coord_list[i];
-        if (g_strcmp0 (coords.timezone, id) == 0)
-        {
-            g_debug ("Coordinates updated, timezone: %s, lat:%.3f, long:%.3f.",
-                    id, coords.latitude, coords.longitude);
-            g_settings_set_value (self->settings,
-                                  "night-light-last-coordinates",
-                                  g_variant_new ("(dd)", coords.latitude, coords.longitude));
-            break;
-        }
+        g_debug ("Coordinates updated, timezone: %s, lat:%.3f, long:%.3f.",
+                id, coords->latitude, coords->longitude);
+        g_settings_set_value (self->settings,
+                              "night-light-last-coordinates",
+                              g_variant_new ("(dd)", coords->latitude, coords->longitude));
     }
 
     g_time_zone_unref (tz);
@@ -544,8 +687,8 @@ csd_night_light_get_temperature (CsdNightLight *self)
 gboolean
 csd_night_light_start (CsdNightLight *self, GError **error)
 {
+        self->running = TRUE;
         night_light_recheck (self);
-        poll_timeout_create (self);
 
         /* care about changes */
         g_signal_connect (self->settings, "changed",
@@ -561,6 +704,7 @@ csd_night_light_finalize (GObject *object)
 {
         CsdNightLight *self = CSD_NIGHT_LIGHT (object);
 
+        self->running = FALSE;
         poll_timeout_destroy (self);
         poll_smooth_destroy (self);
 
@@ -709,6 +853,7 @@ csd_night_light_init (CsdNightLight *self)
         self->cached_sunrise = -1.f;
         self->cached_sunset = -1.f;
         self->cached_temperature = CSD_COLOR_TEMPERATURE_DEFAULT;
+        self->next_recheck = -1.f;
         self->settings = g_settings_new ("org.cinnamon.settings-daemon.plugins.color");
 }
 
@@ -0,0 +1,81 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: nil; c-basic-offset: 8 -*-
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+/* Writes blackbody-rgb.h, colord's Planckian white points sampled over the
+ * night light range, so csd-color-state.c gets the same tint without asking
+ * colord on every gamma update */
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <colord.h>
+
+#define BLACKBODY_TEMPERATURE_MIN       1000
+#define BLACKBODY_TEMPERATURE_MAX       10000
+#define BLACKBODY_TEMPERATURE_STEP      10
+
+int
+main (int argc, char *argv[])
+{
+        CdColorRGB rgb;
+        FILE *f;
+        guint temperature;
+        int retval = EXIT_FAILURE;
+
+        if (argc != 2) {
+                g_printerr ("usage: %s OUTPUT\n", argv[0]);
+                return EXIT_FAILURE;
+        }
+
+        f = fopen (argv[1], "w");
+        if (f == NULL) {
+                g_printerr ("failed to open %s: %s\n", argv[1], g_strerror (errno));
+                return EXIT_FAILURE;
+        }
+
+        fprintf (f,
+                 "// Generated by generate-blackbody-header from colord's Planckian table, used by\n"
+                 "// csd-color-state.c to look up the white point of a color temperature\n\n"
+                 "#define BLACKBODY_TEMPERATURE_MIN       %d\n"
+                 "#define BLACKBODY_TEMPERATURE_MAX       %d\n"
+                 "#define BLACKBODY_TEMPERATURE_STEP      %d\n\n"
+                 "static const gfloat blackbody_rgb_list[][3] = {\n",
+                 BLACKBODY_TEMPERATURE_MIN,
+                 BLACKBODY_TEMPERATURE_MAX,
+                 BLACKBODY_TEMPERATURE_STEP);
+
+        for (temperature = BLACKBODY_TEMPERATURE_MIN;
+             temperature <= BLACKBODY_TEMPERATURE_MAX;
+             temperature += BLACKBODY_TEMPERATURE_STEP) {
+                if (!cd_color_get_blackbody_rgb_full (temperature, &rgb,
+                                                      CD_COLOR_BLACKBODY_FLAG_USE_PLANCKIAN)) {
+                        g_printerr ("failed to get blackbody for %uK\n", temperature);
+                        goto out;
+                }
+                fprintf (f, "    { %.6ff, %.6ff, %.6ff }, /* %uK */\n",
+                         rgb.R, rgb.G, rgb.B, temperature);
+        }
+        fprintf (f, "};\n");
+
+        retval = EXIT_SUCCESS;
+out:
+        if (fclose (f) != 0 && retval == EXIT_SUCCESS) {
+                g_printerr ("failed to write %s: %s\n", argv[1], g_strerror (errno));
+                retval = EXIT_FAILURE;
+        }
+        return retval;
+}
@@ -7,13 +7,19 @@ from pathlib import Path
 COORDS_RE = re.compile(r"([+-]{1}[0-9]{2})([0-9]{2})([0-9]*)([+-]{1}[0-9]{3})([0-9]{2})([0-9]*)")
 
 d = {}
+aliases = {}
 
 parser = ArgumentParser(prog='generate-tz-header',
                         description='Generate tz-coords.h header from timezone-data')
 parser.add_argument('-i', '--zone_tab', nargs='?', default='/usr/share/zoneinfo/zone.tab', type=Path)
+parser.add_argument('-l', '--links', nargs='?', default=None, type=Path,
+                    help='tzdata.zi or backward file with the zone links, defaults to tzdata.zi next to the zone table')
 parser.add_argument('-o', '--out_file', nargs='?', default='tz-coords.h', type=Path)
 args = parser.parse_args()
 
+if args.links is None:
+    args.links = args.zone_tab.parent / 'tzdata.zi'
+
 with open(args.zone_tab, "r") as f:
     for line in f:
         line = line.strip()
@@ -28,8 +34,29 @@ with open(args.zone_tab, "r") as f:
 
         d[tz] = [lat, long]
 
+# backward compatible names, e.g. Asia/Calcutta for Asia/Kolkata
+if args.links.exists():
+    with open(args.links, "r") as f:
+        for line in f:
+            fields = line.split()
+            if len(fields) < 3 or fields[0] not in ("L", "Link"):
+                continue
+            target, alias = fields[1:3]
+            if target in d and alias not in d:
+                aliases[alias] = target
+
+# bsearch() compares with strcmp(), so sort by the bytes
+def c_sorted(names):
+    names = sorted(names, key=lambda name: name.encode())
+    for a, b in zip(names, names[1:]):
+        assert a.encode() < b.encode(), "%s and %s are out of order" % (a, b)
+    return names
+
+zones = c_sorted(d.keys())
+alias_names = c_sorted(aliases.keys())
 header = """
 // Generated from %s, used by csd-nightlight.c to calculate sunrise and sunset based on the system timezone
+// Both lists are sorted by name for bsearch()
 
 typedef struct
 {
@@ -38,15 +65,31 @@ typedef struct
     double longitude;
 } TZCoords;
 
+typedef struct
+{
+    const gchar *alias;
+    guint index;
+} TZAlias;
+
+#define TZ_COORD_COUNT %d
+#define TZ_ALIAS_COUNT %d
+
 static TZCoords tz_coord_list[] = {
-""" % (args.zone_tab)
+""" % (args.zone_tab, len(zones), len(aliases))
 
-for zone in sorted(d.keys()):
+for zone in zones:
     latitude, longitude = d[zone]
 
     header += "    { \"%s\", %f, %f },\n" % (zone, latitude, longitude)
 
-header += "};"
+header += "};\n\n"
+
+header += "static TZAlias tz_alias_list[] = {\n"
+for alias in alias_names:
+    header += "    { \"%s\", %d }, /* %s */\n" % (alias, zones.index(aliases[alias]), aliases[alias])
+if not aliases:
+    header += "    { NULL, 0 },\n"
+header += "};\n"
 
 with open(args.out_file, "w") as f:
     f.write(header)
@@ -41,6 +41,7 @@
 #define GNOME_DESKTOP_USE_UNSTABLE_API
 #include <libcinnamon-desktop/gnome-rr.h>
 
+#include "gpm-backlight.h"
 #include "gpm-common.h"
 #include "gpm-phone.h"
 #include "gpm-idletime.h"
@@ -84,6 +85,9 @@
 
 #define CSD_POWER_MANAGER_CRITICAL_ALERT_TIMEOUT        5 /* seconds */
 #define CSD_POWER_MANAGER_LID_CLOSE_SAFETY_TIMEOUT      30 /* seconds */
+/* well inside logind's default InhibitDelayMaxSec of 5 seconds */
+#define CSD_POWER_MANAGER_LOCK_TIMEOUT                  2000 /* ms */
+#define CSD_POWER_MANAGER_FADE_FRAME_INTERVAL           16 /* ms */
 
 #define LOGIND_DBUS_NAME                       "org.freedesktop.login1"
 #define LOGIND_DBUS_PATH                       "/org/freedesktop/login1"
@@ -119,6 +123,35 @@ abs_to_percentage (int min, int max, int value)
 
 #define CSD_POWER_MANAGER_GET_PRIVATE(o) (G_TYPE_INSTANCE_GET_PRIVATE ((o), CSD_TYPE_POWER_MANAGER, CsdPowerManagerPrivate))
 
+typedef gboolean (*BrightnessFadeWriteFunc) (CsdPowerManager *manager,
+                                             gint value,
+                                             GError **error);
+
+/* one running dim or undim animation, in hardware levels */
+typedef struct {
+        CsdPowerManager         *manager;
+        const gchar             *name;
+        BrightnessFadeWriteFunc  write;
+        gint                     from;
+        gint                     to;
+        gint                     last;          /* level last written */
+        gint64                   start_time;
+        gint64                   duration;      /* us */
+        CsdPowerFadeEasing       easing;
+        guint                    timeout_id;
+} BrightnessFade;
+
+/* running sums over all devices of one kind, for the composite device */
+typedef struct {
+        guint                    devices;
+        guint                    charging;
+        guint                    discharging;
+        guint                    not_fully_charged;
+        gdouble                  energy;
+        gdouble                  energy_full;
+        gdouble                  energy_rate;
+} EngineCompositeTotals;
+
 typedef enum {
         CSD_POWER_IDLE_MODE_NORMAL,
         CSD_POWER_IDLE_MODE_DIM,
@@ -149,16 +182,21 @@ struct CsdPowerManagerPrivate
         gboolean                 skip_unsupported_xrandr;
         gboolean				backlight_helper_force;
         gchar*                  backlight_helper_preference_args;
+        GpmBacklight            *backlight;
         gint                     kbd_brightness_now;
         gint                     kbd_brightness_max;
         gint                     kbd_brightness_old;
         gint                     kbd_brightness_pre_dim;
         GnomeRRScreen           *x11_screen;
+        guint                    randr_external_on;
         gboolean                 use_time_primary;
         gchar                   *previous_summary;
         GIcon                   *previous_icon;
         GpmPhone                *phone;
         GPtrArray               *devices_array;
+        GHashTable              *devices_dirty;
+        guint                    devices_changed_id;
+        GVariant                *devices_blob;
         guint                    action_percentage;
         guint                    action_time;
         guint                    critical_percentage;
@@ -169,7 +207,10 @@ struct CsdPowerManagerPrivate
         gboolean                 notify_mouse;
         gboolean                 notify_other_devices;
         gint                     pre_dim_brightness; /* level, not percentage */
+        BrightnessFade           display_fade;
+        BrightnessFade           kbd_fade;
         UpDevice                *device_composite;
+        EngineCompositeTotals    composite_totals[UP_DEVICE_KIND_LAST];
         NotifyNotification      *notification_discharging;
         NotifyNotification      *notification_low;
         ca_context              *canberra_context;
@@ -192,6 +233,16 @@ struct CsdPowerManagerPrivate
         gboolean                 inhibit_lid_switch_taken;
         gint                     inhibit_suspend_fd;
         gboolean                 inhibit_suspend_taken;
+        gint64                   suspend_announced_time;
+
+        /* screen lock in progress */
+        gboolean                 lock_in_progress;
+        gboolean                 lock_then_blank;
+        gboolean                 lock_then_uninhibit;
+        gint64                   lock_start_time;
+        guint                    lock_timeout_id;
+        guint                    lock_active_changed_id;
+        GCancellable            *lock_cancellable;
         guint                    inhibit_lid_switch_timer_id;
 };
 
@@ -210,7 +261,7 @@ static void      engine_charge_low (CsdPowerManager *manager, UpDevice *device);
 static void      engine_charge_critical (CsdPowerManager *manager, UpDevice *device);
 static void      engine_charge_action (CsdPowerManager *manager, UpDevice *device);
 
-static gboolean  external_monitor_is_connected (GnomeRRScreen *screen);
+static gboolean  external_monitor_is_connected (CsdPowerManager *manager);
 static void      do_power_action_type (CsdPowerManager *manager, CsdPowerActionType action_type);
 static void      do_lid_closed_action (CsdPowerManager *manager);
 static void      inhibit_lid_switch (CsdPowerManager *manager);
@@ -218,6 +269,8 @@ static void      uninhibit_lid_switch (CsdPowerManager *manager);
 static void      setup_locker_process (gpointer user_data);
 static void      lock_screen_with_custom_saver (CsdPowerManager *manager, gchar *custom_saver, gboolean idle_lock);
 static void      activate_screensaver (CsdPowerManager *manager, gboolean force_lock);
+static void      turn_monitors_off (CsdPowerManager *manager);
+static void      uninhibit_suspend (CsdPowerManager *manager);
 static void      kill_lid_close_safety_timer (CsdPowerManager *manager);
 
 static void      backlight_get_output_id (CsdPowerManager *manager, gint *xout, gint *yout);
@@ -776,69 +829,126 @@ engine_recalculate_state (CsdPowerManager *manager)
                 engine_emit_changed (manager, icon_changed, state_changed);
 }
 
+/* the serialized D-Bus form of a device is cached on the device itself
+ * and dropped whenever the device, or the set of devices, changes */
+static void
+engine_device_blob_invalidate (CsdPowerManager *manager, UpDevice *device)
+{
+        if (device != NULL)
+                g_object_set_data (G_OBJECT (device), "engine-variant-blob", NULL);
+        g_clear_pointer (&manager->priv->devices_blob, g_variant_unref);
+}
+
+/* what a device last added to the per-kind composite totals */
+typedef struct {
+        UpDeviceKind             kind;
+        UpDeviceState            state;
+        gdouble                  energy;
+        gdouble                  energy_full;
+        gdouble                  energy_rate;
+} EngineCompositeEntry;
+
+static void
+engine_composite_totals_apply (CsdPowerManager *manager,
+                               const EngineCompositeEntry *entry,
+                               gint sign)
+{
+        EngineCompositeTotals *totals;
+
+        if (entry->kind >= UP_DEVICE_KIND_LAST)
+                return;
+
+        totals = &manager->priv->composite_totals[entry->kind];
+        totals->devices += sign;
+        if (entry->state == UP_DEVICE_STATE_CHARGING)
+                totals->charging += sign;
+        if (entry->state == UP_DEVICE_STATE_DISCHARGING)
+                totals->discharging += sign;
+        if (entry->state != UP_DEVICE_STATE_FULLY_CHARGED)
+                totals->not_fully_charged += sign;
+
+        /* don't let rounding errors accumulate once the kind is gone */
+        if (totals->devices == 0) {
+                memset (totals, 0, sizeof (EngineCompositeTotals));
+                return;
+        }
+        totals->energy += sign * entry->energy;
+        totals->energy_full += sign * entry->energy_full;
+        totals->energy_rate += sign * entry->energy_rate;
+}
+
+/* replace the contribution of @device to the composite totals with its
+ * current values, this is the only place device properties are read */
+static void
+engine_composite_device_refresh (CsdPowerManager *manager, UpDevice *device)
+{
+        EngineCompositeEntry *entry;
+
+        entry = g_object_get_data (G_OBJECT (device), "engine-composite-entry");
+        if (entry == NULL) {
+                entry = g_new0 (EngineCompositeEntry, 1);
+                g_object_set_data_full (G_OBJECT (device), "engine-composite-entry",
+                                        entry, g_free);
+        } else {
+                engine_composite_totals_apply (manager, entry, -1);
+        }
+
+        g_object_get (device,
+                      "kind", &entry->kind,
+                      "state", &entry->state,
+                      "energy", &entry->energy,
+                      "energy-full", &entry->energy_full,
+                      "energy-rate", &entry->energy_rate,
+                      NULL);
+        engine_composite_totals_apply (manager, entry, 1);
+}
+
+static void
+engine_composite_device_remove (CsdPowerManager *manager, UpDevice *device)
+{
+        EngineCompositeEntry *entry;
+
+        entry = g_object_get_data (G_OBJECT (device), "engine-composite-entry");
+        if (entry == NULL)
+                return;
+
+        engine_composite_totals_apply (manager, entry, -1);
+        g_object_set_data (G_OBJECT (device), "engine-composite-entry", NULL);
+}
+
 static UpDevice *
 engine_get_composite_device (CsdPowerManager *manager,
                              UpDevice *original_device)
 {
-        guint battery_devices = 0;
-        GPtrArray *array;
-        UpDevice *device;
-        UpDeviceKind kind;
         UpDeviceKind original_kind;
-        guint i;
 
         /* get the type of the original device */
         g_object_get (original_device,
                       "kind", &original_kind,
                       NULL);
 
-        /* find out how many batteries in the system */
-        array = manager->priv->devices_array;
-        for (i=0;i<array->len;i++) {
-                device = g_ptr_array_index (array, i);
-                g_object_get (device,
-                              "kind", &kind,
-                              NULL);
-                if (kind == original_kind)
-                        battery_devices++;
-        }
-
         /* just use the original device if only one primary battery */
-        if (battery_devices <= 1) {
+        if (original_kind >= UP_DEVICE_KIND_LAST ||
+            manager->priv->composite_totals[original_kind].devices <= 1) {
                 g_debug ("using original device as only one primary battery");
-                device = original_device;
-                goto out;
+                return original_device;
         }
 
         /* use the composite device */
-        device = manager->priv->device_composite;
-out:
-        /* return composite device or original device */
-        return device;
+        return manager->priv->device_composite;
 }
 
+/* the caller must have refreshed @original_device's contribution */
 static UpDevice *
 engine_update_composite_device (CsdPowerManager *manager,
                                 UpDevice *original_device)
 {
-        guint i;
         gdouble percentage = 0.0;
-        gdouble energy = 0.0;
-        gdouble energy_full = 0.0;
-        gdouble energy_rate = 0.0;
-        gdouble energy_total = 0.0;
-        gdouble energy_full_total = 0.0;
-        gdouble energy_rate_total = 0.0;
         gint64 time_to_empty = 0;
         gint64 time_to_full = 0;
-        guint battery_devices = 0;
-        gboolean is_charging = FALSE;
-        gboolean is_discharging = FALSE;
-        gboolean is_fully_charged = TRUE;
-        GPtrArray *array;
+        EngineCompositeTotals *totals;
         UpDevice *device;
         UpDeviceState state;
-        UpDeviceKind kind;
         UpDeviceKind original_kind;
 
         /* get the type of the original device */
@@ -846,72 +956,41 @@ engine_update_composite_device (CsdPowerManager *manager,
                       "kind", &original_kind,
                       NULL);
 
-        /* update the composite device */
-        array = manager->priv->devices_array;
-        for (i=0;i<array->len;i++) {
-                device = g_ptr_array_index (array, i);
-                g_object_get (device,
-                              "kind", &kind,
-                              "state", &state,
-                              "energy", &energy,
-                              "energy-full", &energy_full,
-                              "energy-rate", &energy_rate,
-                              NULL);
-                if (kind != original_kind)
-                        continue;
-
-                /* one of these will be charging or discharging */
-                if (state == UP_DEVICE_STATE_CHARGING)
-                        is_charging = TRUE;
-                if (state == UP_DEVICE_STATE_DISCHARGING)
-                        is_discharging = TRUE;
-                if (state != UP_DEVICE_STATE_FULLY_CHARGED)
-                        is_fully_charged = FALSE;
-
-                /* sum up composite */
-                energy_total += energy;
-                energy_full_total += energy_full;
-                energy_rate_total += energy_rate;
-                battery_devices++;
-        }
-
         /* just use the original device if only one primary battery */
-        if (battery_devices == 1) {
-                g_debug ("using original device as only one primary battery");
-                device = original_device;
+        device = engine_get_composite_device (manager, original_device);
+        if (device == original_device)
                 goto out;
-        }
+
+        totals = &manager->priv->composite_totals[original_kind];
 
         /* use percentage weighted for each battery capacity */
-        if (energy_full_total > 0.0)
-                percentage = 100.0 * energy_total / energy_full_total;
+        if (totals->energy_full > 0.0)
+                percentage = 100.0 * totals->energy / totals->energy_full;
 
         /* set composite state */
-        if (is_charging)
+        if (totals->charging > 0)
                 state = UP_DEVICE_STATE_CHARGING;
-        else if (is_discharging)
+        else if (totals->discharging > 0)
                 state = UP_DEVICE_STATE_DISCHARGING;
-        else if (is_fully_charged)
+        else if (totals->not_fully_charged == 0)
                 state = UP_DEVICE_STATE_FULLY_CHARGED;
         else
                 state = UP_DEVICE_STATE_UNKNOWN;
 
         /* calculate a quick and dirty time remaining value */
-        if (energy_rate_total > 0) {
+        if (totals->energy_rate > 0) {
                 if (state == UP_DEVICE_STATE_DISCHARGING)
-                        time_to_empty = 3600 * (energy_total / energy_rate_total);
+                        time_to_empty = 3600 * (totals->energy / totals->energy_rate);
                 else if (state == UP_DEVICE_STATE_CHARGING)
-                        time_to_full = 3600 * ((energy_full_total - energy_total) / energy_rate_total);
+                        time_to_full = 3600 * ((totals->energy_full - totals->energy) / totals->energy_rate);
         }
 
-        /* okay, we can use the composite device */
-        device = manager->priv->device_composite;
-
         g_debug ("printing composite device");
+        engine_device_blob_invalidate (manager, device);
         g_object_set (device,
-                      "energy", energy,
-                      "energy-full", energy_full,
-                      "energy-rate", energy_rate,
+                      "energy", totals->energy,
+                      "energy-full", totals->energy_full,
+                      "energy-rate", totals->energy_rate,
                       "time-to-empty", time_to_empty,
                       "time-to-full", time_to_full,
                       "percentage", percentage,
@@ -919,9 +998,6 @@ engine_update_composite_device (CsdPowerManager *manager,
                       NULL);
 
 out:
-        /* force update of icon */
-	engine_recalculate_state (manager);
-	
         /* return composite device or original device */
         return device;
 }
@@ -954,6 +1030,8 @@ engine_device_add (CsdPowerManager *manager, UpDevice *device)
                            GUINT_TO_POINTER(state));
 
         g_ptr_array_add (manager->priv->devices_array, g_object_ref(device));
+        engine_composite_device_refresh (manager, device);
+        engine_device_blob_invalidate (manager, NULL);
 
         g_signal_connect (device, "notify",
                           G_CALLBACK (device_properties_changed_cb), manager);
@@ -961,6 +1039,7 @@ engine_device_add (CsdPowerManager *manager, UpDevice *device)
         if (kind == UP_DEVICE_KIND_BATTERY) {
                 g_debug ("updating because we added a device");
                 composite = engine_update_composite_device (manager, device);
+                engine_recalculate_state (manager);
 
                 /* get the same values for the composite device */
                 warning = engine_get_warning (manager, composite);
@@ -1013,8 +1092,8 @@ engine_coldplug (CsdPowerManager *manager)
 static void
 engine_device_added_cb (UpClient *client, UpDevice *device, CsdPowerManager *manager)
 {
-        /* add to list */
-        g_ptr_array_add (manager->priv->devices_array, g_object_ref (device));
+        /* add to list, and watch it like coldplugged devices */
+        engine_device_add (manager, device);
         engine_recalculate_state (manager);
 }
 
@@ -1027,6 +1106,10 @@ engine_device_removed_cb (UpClient *client, const char *object_path, CsdPowerMan
                 UpDevice *device = g_ptr_array_index (manager->priv->devices_array, i);
 
                 if (g_strcmp0 (object_path, up_device_get_object_path (device)) == 0) {
+                        g_hash_table_remove (manager->priv->devices_dirty, device);
+                        g_signal_handlers_disconnect_by_data (device, manager);
+                        engine_device_blob_invalidate (manager, device);
+                        engine_composite_device_remove (manager, device);
                         g_ptr_array_remove_index (manager->priv->devices_array, i);
                         break;
                 }
@@ -1672,19 +1755,13 @@ out:
 }
 
 static void
-device_properties_changed_cb (UpDevice *device, GParamSpec *pspec, CsdPowerManager *manager)
+engine_device_changed (CsdPowerManager *manager, UpDevice *device, UpDeviceKind kind)
 {
-        UpDeviceKind kind;
         UpDeviceState state;
         UpDeviceState state_old;
         CsdPowerManagerWarning warning_old;
         CsdPowerManagerWarning warning;
 
-        /* get device properties */
-        g_object_get (device,
-                      "kind", &kind,
-                      NULL);
-
         /* if battery then use composite device to cope with multiple batteries */
         if (kind == UP_DEVICE_KIND_BATTERY) {
                 g_debug ("updating because %s changed", up_device_get_object_path (device));
@@ -1732,8 +1809,66 @@ device_properties_changed_cb (UpDevice *device, GParamSpec *pspec, CsdPowerManag
                 /* save new state */
                 g_object_set_data (G_OBJECT(device), "engine-warning-old", GUINT_TO_POINTER(warning));
         }
+}
+
+static gboolean
+engine_devices_changed_idle_cb (CsdPowerManager *manager)
+{
+        GHashTableIter iter;
+        GHashTable *dirty;
+        gpointer key;
+        UpDeviceKind kind;
+        gboolean battery_done = FALSE;
+
+        manager->priv->devices_changed_id = 0;
+
+        /* take the batch, anything changing from here on gets the next one */
+        dirty = manager->priv->devices_dirty;
+        manager->priv->devices_dirty = g_hash_table_new_full (g_direct_hash, g_direct_equal,
+                                                              g_object_unref, NULL);
+
+        /* bring the composite totals up to date with the whole batch first */
+        g_hash_table_iter_init (&iter, dirty);
+        while (g_hash_table_iter_next (&iter, &key, NULL))
+                engine_composite_device_refresh (manager, UP_DEVICE (key));
+
+        g_hash_table_iter_init (&iter, dirty);
+        while (g_hash_table_iter_next (&iter, &key, NULL)) {
+                g_object_get (key, "kind", &kind, NULL);
+
+                /* every battery maps to the same composite device */
+                if (kind == UP_DEVICE_KIND_BATTERY) {
+                        if (battery_done)
+                                continue;
+                        battery_done = TRUE;
+                }
+                engine_device_changed (manager, UP_DEVICE (key), kind);
+        }
+        g_hash_table_unref (dirty);
 
         engine_recalculate_state (manager);
+        return FALSE;
+}
+
+/* UPower updates several properties per refresh and "notify" fires for
+ * each of them, so only note the device here and do the real work once
+ * all pending notifications have been dispatched */
+static void
+device_properties_changed_cb (UpDevice *device, GParamSpec *pspec, CsdPowerManager *manager)
+{
+        if (manager->priv->devices_dirty == NULL)
+                return;
+
+        engine_device_blob_invalidate (manager, device);
+
+        if (!g_hash_table_contains (manager->priv->devices_dirty, device))
+                g_hash_table_add (manager->priv->devices_dirty, g_object_ref (device));
+
+        if (manager->priv->devices_changed_id != 0)
+                return;
+
+        manager->priv->devices_changed_id = g_idle_add ((GSourceFunc) engine_devices_changed_idle_cb, manager);
+        g_source_set_name_by_id (manager->priv->devices_changed_id, "[CsdPowerManager] devices changed");
 }
 
 static void
@@ -1826,6 +1961,8 @@ phone_device_removed_cb (GpmPhone *phone, guint idx, CsdPowerManager *manager)
                               NULL);
 
                 if (kind == UP_DEVICE_KIND_PHONE) {
+                        engine_composite_device_remove (manager, device);
+                        engine_device_blob_invalidate (manager, device);
                         g_ptr_array_remove_index (manager->priv->devices_array, i);
                         break;
                 }
@@ -1859,6 +1996,7 @@ phone_device_refresh_cb (GpmPhone *phone, guint idx, CsdPowerManager *manager)
                               NULL);
 
                 if (kind == UP_DEVICE_KIND_PHONE) {
+                        engine_device_blob_invalidate (manager, device);
                         is_present = gpm_phone_get_present (phone, idx);
                         state = gpm_phone_get_on_ac (phone, idx) ? UP_DEVICE_STATE_CHARGING : UP_DEVICE_STATE_DISCHARGING;
                         percentage = gpm_phone_get_percentage (phone, idx);
@@ -1975,13 +2113,137 @@ do_power_action_type (CsdPowerManager *manager,
                 /* Lock first or else xrandr might reconfigure stuff and the ss's coverage
                  * may be incorrect upon return. */
                 activate_screensaver (manager, FALSE);
-                turn_monitors_off (manager);
+                if (manager->priv->lock_in_progress)
+                        manager->priv->lock_then_blank = TRUE;
+                else
+                        turn_monitors_off (manager);
                 break;
         case CSD_POWER_ACTION_NOTHING:
                 break;
         }
 }
 
+static gdouble
+brightness_fade_ease (CsdPowerFadeEasing easing, gdouble t)
+{
+        switch (easing) {
+        case CSD_POWER_FADE_EASING_EASE_OUT:
+                return 1.0 - (1.0 - t) * (1.0 - t);
+        case CSD_POWER_FADE_EASING_EASE_IN_OUT:
+                if (t < 0.5)
+                        return 2.0 * t * t;
+                return 1.0 - 2.0 * (1.0 - t) * (1.0 - t);
+        case CSD_POWER_FADE_EASING_LINEAR:
+        default:
+                return t;
+        }
+}
+
+static void
+brightness_fade_stop (BrightnessFade *fade)
+{
+        if (fade->timeout_id == 0)
+                return;
+        g_source_remove (fade->timeout_id);
+        fade->timeout_id = 0;
+}
+
+/* the level to start a new fade from, if one is already under way */
+static gint
+brightness_fade_get_level (BrightnessFade *fade, gint hw_level)
+{
+        if (fade->timeout_id != 0)
+                return fade->last;
+        return hw_level;
+}
+
+static gboolean
+brightness_fade_frame_cb (gpointer user_data)
+{
+        BrightnessFade *fade = (BrightnessFade *) user_data;
+        GError *error = NULL;
+        gdouble progress;
+        gdouble delta;
+        gint value;
+
+        /* driven by the clock, not by the number of frames we were given */
+        progress = (gdouble) (g_get_monotonic_time () - fade->start_time) / fade->duration;
+        progress = CLAMP (progress, 0.0, 1.0);
+        delta = (fade->to - fade->from) * brightness_fade_ease (fade->easing, progress);
+        value = fade->from + (gint) (delta < 0 ? delta - 0.5 : delta + 0.5);
+
+        /* many frames land on the same level when the range is small */
+        if (value != fade->last) {
+                if (!fade->write (fade->manager, value, &error)) {
+                        g_warning ("failed to fade %s backlight to %i: %s",
+                                   fade->name, value, error->message);
+                        g_error_free (error);
+                        fade->timeout_id = 0;
+                        return G_SOURCE_REMOVE;
+                }
+                fade->last = value;
+        }
+
+        if (progress < 1.0)
+                return G_SOURCE_CONTINUE;
+
+        g_debug ("%s backlight fade to %i done", fade->name, fade->to);
+        fade->timeout_id = 0;
+        return G_SOURCE_REMOVE;
+}
+
+/**
+ * brightness_fade_start:
+ *
+ * Animates from @from to @to using the configured duration and easing,
+ * replacing any fade already running. With a zero duration the target is
+ * written straight away.
+ *
+ * Return value: Success. If FALSE then @error is set.
+ **/
+static gboolean
+brightness_fade_start (BrightnessFade *fade, gint from, gint to, GError **error)
+{
+        GSettings *settings = fade->manager->priv->settings;
+        gint duration;
+
+        brightness_fade_stop (fade);
+
+        duration = g_settings_get_int (settings, "idle-dim-fade-duration");
+        if (duration <= 0 || from == to) {
+                if (!fade->write (fade->manager, to, error))
+                        return FALSE;
+                fade->last = to;
+                return TRUE;
+        }
+
+        g_debug ("fading %s backlight from %i to %i over %ims",
+                 fade->name, from, to, duration);
+        fade->from = from;
+        fade->to = to;
+        fade->last = from;
+        fade->start_time = g_get_monotonic_time ();
+        fade->duration = (gint64) duration * 1000;
+        fade->easing = g_settings_get_enum (settings, "idle-dim-fade-easing");
+        fade->timeout_id = g_timeout_add (CSD_POWER_MANAGER_FADE_FRAME_INTERVAL,
+                                          brightness_fade_frame_cb,
+                                          fade);
+        g_source_set_name_by_id (fade->timeout_id, "[CsdPowerManager] brightness fade");
+        return TRUE;
+}
+
+static void
+brightness_fade_init (CsdPowerManager *manager,
+                      BrightnessFade *fade,
+                      const gchar *name,
+                      BrightnessFadeWriteFunc write)
+{
+        memset (fade, 0, sizeof (BrightnessFade));
+        fade->manager = manager;
+        fade->name = name;
+        fade->write = write;
+}
+
 static gboolean
 upower_kbd_get_percentage (CsdPowerManager *manager, GError **error)
 {
@@ -2040,12 +2302,20 @@ upower_kbd_set_brightness (CsdPowerManager *manager, guint value, GError **error
         return TRUE;
 }
 
+static gboolean
+upower_kbd_fade_write (CsdPowerManager *manager, gint value, GError **error)
+{
+        return upower_kbd_set_brightness (manager, value, error);
+}
+
 static gboolean
 upower_kbd_toggle (CsdPowerManager *manager,
                    GError **error)
 {
         gboolean ret;
 
+        brightness_fade_stop (&manager->priv->kbd_fade);
+
         if (manager->priv->kbd_brightness_old >= 0) {
                 g_debug ("keyboard toggle off");
                 ret = upower_kbd_set_brightness (manager,
@@ -2103,7 +2373,7 @@ suspend_on_lid_close (CsdPowerManager *manager)
 {
         CsdXrandrBootBehaviour val;
 
-        if (!external_monitor_is_connected (manager->priv->x11_screen))
+        if (!external_monitor_is_connected (manager))
                 return TRUE;
 
         val = g_settings_get_enum (manager->priv->settings_xrandr, "default-monitors-setup");
@@ -2167,21 +2437,35 @@ randr_output_is_on (GnomeRROutput *output)
         return gnome_rr_crtc_get_current_mode (crtc) != NULL;
 }
 
-static gboolean
-external_monitor_is_connected (GnomeRRScreen *screen)
+/* count the external outputs that are on, so lid decisions need no
+ * RANDR queries; called whenever GnomeRRScreen has changed */
+static void
+randr_outputs_refresh (CsdPowerManager *manager)
 {
         GnomeRROutput **outputs;
+        gboolean on;
+        gboolean builtin;
         guint i;
 
-        /* see if we have more than one screen plugged in */
-        outputs = gnome_rr_screen_list_outputs (screen);
-        for (i = 0; outputs[i] != NULL; i++) {
-                if (randr_output_is_on (outputs[i]) &&
-                    !gnome_rr_output_is_builtin_display (outputs[i]))
-                        return TRUE;
+        manager->priv->randr_external_on = 0;
+
+        outputs = gnome_rr_screen_list_outputs (manager->priv->x11_screen);
+        for (i = 0; outputs != NULL && outputs[i] != NULL; i++) {
+                on = randr_output_is_on (outputs[i]);
+                builtin = gnome_rr_output_is_builtin_display (outputs[i]);
+                if (on && !builtin)
+                        manager->priv->randr_external_on++;
+
+                g_debug ("output %s: on %i, builtin %i",
+                         gnome_rr_output_get_name (outputs[i]), on, builtin);
         }
+}
 
-        return FALSE;
+static gboolean
+external_monitor_is_connected (CsdPowerManager *manager)
+{
+        /* see if we have more than one screen plugged in */
+        return manager->priv->randr_external_on > 0;
 }
 
 static void
@@ -2189,6 +2473,8 @@ on_randr_event (GnomeRRScreen *screen, gpointer user_data)
 {
         CsdPowerManager *manager = CSD_POWER_MANAGER (user_data);
 
+        randr_outputs_refresh (manager);
+
         if (suspend_on_lid_close (manager)) {
                 restart_inhibit_lid_switch_timer (manager);
                 return;
@@ -2244,32 +2530,9 @@ do_lid_open_action (CsdPowerManager *manager)
 }
 
 static gboolean
-is_on (GnomeRROutput *output)
+non_laptop_outputs_are_all_off (CsdPowerManager *manager)
 {
-	GnomeRRCrtc *crtc;
-
-	crtc = gnome_rr_output_get_crtc (output);
-	if (!crtc)
-		return FALSE;
-	return gnome_rr_crtc_get_current_mode (crtc) != NULL;
-}
-
-static gboolean
-non_laptop_outputs_are_all_off (GnomeRRScreen *screen)
-{
-        GnomeRROutput **outputs;
-        int i;
-
-        outputs = gnome_rr_screen_list_outputs (screen);
-        for (i = 0; outputs[i] != NULL; i++) {
-                if (gnome_rr_output_is_builtin_display (outputs[i]))
-                        continue;
-
-                if (is_on (outputs[i]))
-                        return FALSE;
-        }
-
-        return TRUE;
+        return manager->priv->randr_external_on == 0;
 }
 
 /* Timeout callback used to check conditions when the laptop's lid is closed but
@@ -2352,12 +2615,13 @@ do_lid_closed_action (CsdPowerManager *manager)
                          CA_PROP_EVENT_DESCRIPTION, _("Lid has been closed"),
                          NULL);
 
-        /* refresh RANDR so we get an accurate view of what monitors are plugged in when the lid is closed */
-        gnome_rr_screen_refresh (manager->priv->x11_screen, NULL); /* NULL-GError */
+        /* the output table is kept current by on_randr_event(), GnomeRRScreen
+         * refreshes itself on RANDR notifications so there is no need to
+         * query the X server here */
 
         /* perform policy action */
         if (g_settings_get_boolean (manager->priv->settings, "lid-close-suspend-with-external-monitor")
-            || non_laptop_outputs_are_all_off (manager->priv->x11_screen)) {
+            || non_laptop_outputs_are_all_off (manager)) {
                 g_debug ("lid is closed; suspending or hibernating");
                 suspend_with_lid_closed (manager);
         } else {
@@ -2487,6 +2751,11 @@ backlight_override_settings_refresh (CsdPowerManager *manager)
         g_free(tmp2);
         tmp2 = NULL;
 
+        /* the persistent backend resolves the same device as the helper would */
+        if (manager->priv->backlight != NULL)
+                gpm_backlight_set_preference_order (manager->priv->backlight,
+                                                    backlight_preference_order);
+
         g_free(backlight_preference_order);
         backlight_preference_order = NULL;
 }
@@ -2655,6 +2924,50 @@ backlight_get_output_id (CsdPowerManager *manager,
         *yout = y;
 }
 
+/**
+ * backlight_get_abs:
+ *
+ * Gets the raw brightness level and maximum, from the persistent
+ * backlight backend if it found a device, otherwise from the helper.
+ * @now may be NULL if only the maximum is wanted.
+ *
+ * Return value: Success. If FALSE then @error is set.
+ **/
+static gboolean
+backlight_get_abs (CsdPowerManager *manager, gint *max, gint *now, GError **error)
+{
+        if (manager->priv->backlight != NULL &&
+            gpm_backlight_is_available (manager->priv->backlight)) {
+                *max = gpm_backlight_get_max_brightness (manager->priv->backlight);
+                if (now == NULL)
+                        return TRUE;
+                *now = gpm_backlight_get_brightness (manager->priv->backlight, error);
+                return *now >= 0;
+        }
+
+        /* fall back to the polkit helper */
+        *max = backlight_helper_get_value ("get-max-brightness", manager, error);
+        if (*max < 0)
+                return FALSE;
+        if (now == NULL)
+                return TRUE;
+        *now = backlight_helper_get_value ("get-brightness", manager, error);
+        return *now >= 0;
+}
+
+static gboolean
+backlight_set_abs (CsdPowerManager *manager, gint value, GError **error)
+{
+        /* an explicit change wins over a dim or undim in progress */
+        brightness_fade_stop (&manager->priv->display_fade);
+
+        if (manager->priv->backlight != NULL &&
+            gpm_backlight_is_available (manager->priv->backlight))
+                return gpm_backlight_set_brightness (manager->priv->backlight, value, error);
+
+        return backlight_helper_set_value ("set-brightness", value, manager, error);
+}
+
 static gint
 min_abs_brightness (CsdPowerManager *manager, gint min, gint max)
 {
@@ -2689,15 +3002,9 @@ backlight_get_percentage (CsdPowerManager *manager, GError **error)
                 }
         }
 
-        /* fall back to the polkit helper */
-        max = backlight_helper_get_value ("get-max-brightness", manager, error);
-        if (max < 0) {
-                goto out;
-            }
-        now = backlight_helper_get_value ("get-brightness", manager, error);
-        if (now < 0) {
+        /* fall back to the sysfs backlight */
+        if (!backlight_get_abs (manager, &max, &now, error))
                 goto out;
-            }
 
         value = ABS_TO_PERCENTAGE (min_abs_brightness (manager, min, max), max, now);
 out:
@@ -2714,6 +3021,16 @@ backlight_emit_changed (CsdPowerManager *manager)
         csd_screen_emit_changed (manager->priv->screen_iface);
 }
 
+static void
+backlight_brightness_changed_cb (GpmBacklight *backlight,
+                                 gint value,
+                                 CsdPowerManager *manager)
+{
+        /* changed outside of c-s-d, e.g. by a firmware hotkey */
+        g_debug ("backlight changed externally to %i", value);
+        backlight_emit_changed (manager);
+}
+
 static gboolean
 backlight_set_percentage (CsdPowerManager *manager,
                           guint value,
@@ -2751,16 +3068,12 @@ backlight_set_percentage (CsdPowerManager *manager,
         gint max = 0;
         gint new;
 
-        /* fall back to the polkit helper */
-        max = backlight_helper_get_value ("get-max-brightness", manager, error);
-        if (max < 0)
+        /* fall back to the sysfs backlight */
+        if (!backlight_get_abs (manager, &max, NULL, error))
                 goto out;
 
         new = CLAMP (PERCENTAGE_TO_ABS (min_abs_brightness (manager, min, max), max, value), min_abs_brightness (manager, min, max), max);
-        ret = backlight_helper_set_value ("set-brightness",
-                                          new,
-                                          manager,
-                                          error);
+        ret = backlight_set_abs (manager, new, error);
 out:
         if (ret && emit_changed)
                 backlight_emit_changed (manager);
@@ -2818,19 +3131,12 @@ backlight_step_up (CsdPowerManager *manager, GError **error)
         gint max = 0;
         gint min = 0;
 
-        /* fall back to the polkit helper */
-        current = backlight_helper_get_value ("get-brightness", manager, error);
-        if (current < 0)
-                goto out;
-        max = backlight_helper_get_value ("get-max-brightness", manager, error);
-        if (max < 0)
+        /* fall back to the sysfs backlight */
+        if (!backlight_get_abs (manager, &max, &current, error))
                 goto out;
         step = BRIGHTNESS_STEP_AMOUNT (max - min_abs_brightness (manager, min, max));
         new = MIN (current + step, max);
-        ret = backlight_helper_set_value ("set-brightness",
-                                          new,
-                                          manager,
-                                          error);
+        ret = backlight_set_abs (manager, new, error);
         if (ret)
                 percentage_value = ABS_TO_PERCENTAGE (min_abs_brightness (manager, min, max), max, new);
 out:
@@ -2890,19 +3196,12 @@ backlight_step_down (CsdPowerManager *manager, GError **error)
         gint min = 0;
         gint max = 0;
 
-        /* fall back to the polkit helper */
-        current = backlight_helper_get_value ("get-brightness", manager, error);
-        if (current < 0)
-                goto out;
-        max = backlight_helper_get_value ("get-max-brightness", manager, error);
-        if (max < 0)
+        /* fall back to the sysfs backlight */
+        if (!backlight_get_abs (manager, &max, &current, error))
                 goto out;
         step = BRIGHTNESS_STEP_AMOUNT (max - min_abs_brightness (manager, min, max));
         new = MAX (current - step, min_abs_brightness (manager, min, max));
-        ret = backlight_helper_set_value ("set-brightness",
-                                          new,
-                                          manager,
-                                          error);
+        ret = backlight_set_abs (manager, new, error);
         if (ret)
                 percentage_value = ABS_TO_PERCENTAGE (min_abs_brightness (manager, min, max), max, new);
 out:
@@ -2911,6 +3210,47 @@ out:
         return percentage_value;
 }
 
+static gboolean
+backlight_fade_write (CsdPowerManager *manager, gint value, GError **error)
+{
+        return gpm_backlight_set_brightness (manager->priv->backlight, value, error);
+}
+
+/**
+ * backlight_fade_to_percentage:
+ *
+ * Fades the panel to @value when the sysfs device is in use, every frame
+ * being a cached write through the backlight backend. XRandR and helper
+ * backlights are set in a single step like before.
+ *
+ * Return value: Success. If FALSE then @error is set.
+ **/
+static gboolean
+backlight_fade_to_percentage (CsdPowerManager *manager,
+                              gint value,
+                              GError **error)
+{
+        gint max;
+        gint min;
+        gint now;
+
+        if ((!manager->priv->skip_unsupported_xrandr && !manager->priv->backlight_helper_force) ||
+            manager->priv->backlight == NULL ||
+            !gpm_backlight_is_available (manager->priv->backlight))
+                return backlight_set_percentage (manager, value, FALSE, error);
+
+        max = gpm_backlight_get_max_brightness (manager->priv->backlight);
+        now = gpm_backlight_get_brightness (manager->priv->backlight, error);
+        if (now < 0)
+                return FALSE;
+
+        min = min_abs_brightness (manager, 0, max);
+        return brightness_fade_start (&manager->priv->display_fade,
+                                      brightness_fade_get_level (&manager->priv->display_fade, now),
+                                      CLAMP (PERCENTAGE_TO_ABS (min, max, value), min, max),
+                                      error);
+}
+
 static gboolean
 display_backlight_dim (CsdPowerManager *manager,
                        gint idle_percentage,
@@ -2935,9 +3275,7 @@ display_backlight_dim (CsdPowerManager *manager,
                 goto out;
         }
 
-        ret = backlight_set_percentage (manager, idle_percentage,
-                                        FALSE,
-                                        error);
+        ret = backlight_fade_to_percentage (manager, idle_percentage, error);
         if (!ret) {
                 goto out;
         }
@@ -2970,7 +3308,7 @@ kbd_backlight_dim (CsdPowerManager *manager,
                          now, max, idle, max);
                 return TRUE;
         }
-        ret = upower_kbd_set_brightness (manager, idle, error);
+        ret = brightness_fade_start (&manager->priv->kbd_fade, now, idle, error);
         if (!ret)
                 return FALSE;
 
@@ -3099,10 +3437,9 @@ idle_set_mode (CsdPowerManager *manager, CsdPowerIdleMode mode)
 
                 /* reset brightness if we dimmed */
                 if (manager->priv->pre_dim_brightness >= 0) {
-                        ret = backlight_set_percentage (manager,
-                                                        manager->priv->pre_dim_brightness,
-                                                        FALSE,
-                                                        &error);
+                        ret = backlight_fade_to_percentage (manager,
+                                                            manager->priv->pre_dim_brightness,
+                                                            &error);
                         if (!ret) {
                                 g_warning ("failed to restore backlight to %i: %s",
                                            manager->priv->pre_dim_brightness,
@@ -3126,9 +3463,10 @@ idle_set_mode (CsdPowerManager *manager, CsdPowerIdleMode mode)
 
                 /* reset kbd brightness if we dimmed */
                 if (manager->priv->kbd_brightness_pre_dim >= 0) {
-                        ret = upower_kbd_set_brightness (manager,
-                                                         manager->priv->kbd_brightness_pre_dim,
-                                                         &error);
+                        ret = brightness_fade_start (&manager->priv->kbd_fade,
+                                                     manager->priv->kbd_brightness_now,
+                                                     manager->priv->kbd_brightness_pre_dim,
+                                                     &error);
                         if (!ret) {
                                 g_warning ("failed to restore kbd backlight to %i: %s",
                                            manager->priv->kbd_brightness_pre_dim,
@@ -3471,37 +3809,211 @@ quit:
         g_clear_error (&error);
 }
 
+static void
+screensaver_lock_done (CsdPowerManager *manager,
+                       gboolean locked,
+                       const gchar *reason)
+{
+        gint64 now;
+
+        if (!manager->priv->lock_in_progress)
+                return;
+        manager->priv->lock_in_progress = FALSE;
+
+        now = g_get_monotonic_time ();
+        if (locked) {
+                g_debug ("screen locked after %" G_GINT64_FORMAT " ms",
+                         (now - manager->priv->lock_start_time) / 1000);
+        } else {
+                g_warning ("screen lock not confirmed after %" G_GINT64_FORMAT " ms: %s",
+                           (now - manager->priv->lock_start_time) / 1000,
+                           reason);
+        }
+
+        if (manager->priv->lock_timeout_id != 0) {
+                g_source_remove (manager->priv->lock_timeout_id);
+                manager->priv->lock_timeout_id = 0;
+        }
+        if (manager->priv->lock_active_changed_id != 0) {
+                g_dbus_connection_signal_unsubscribe (manager->priv->connection,
+                                                      manager->priv->lock_active_changed_id);
+                manager->priv->lock_active_changed_id = 0;
+        }
+
+        /* replies still on their way belong to this sequence, not the next */
+        if (manager->priv->lock_cancellable != NULL)
+                g_cancellable_cancel (manager->priv->lock_cancellable);
+        g_clear_object (&manager->priv->lock_cancellable);
+
+        if (manager->priv->lock_then_blank) {
+                manager->priv->lock_then_blank = FALSE;
+                turn_monitors_off (manager);
+        }
+
+        /* logind is waiting for us, let it carry on with the suspend */
+        if (manager->priv->lock_then_uninhibit) {
+                manager->priv->lock_then_uninhibit = FALSE;
+                g_debug ("releasing the suspend inhibitor %" G_GINT64_FORMAT " ms after PrepareForSleep",
+                         (now - manager->priv->suspend_announced_time) / 1000);
+                uninhibit_suspend (manager);
+        }
+}
+
+static gboolean
+screensaver_lock_timeout_cb (CsdPowerManager *manager)
+{
+        manager->priv->lock_timeout_id = 0;
+        screensaver_lock_done (manager, FALSE, "timed out");
+        return FALSE;
+}
+
+static void
+screensaver_active_changed_cb (GDBusConnection *connection,
+                               const gchar     *sender_name,
+                               const gchar     *object_path,
+                               const gchar     *interface_name,
+                               const gchar     *signal_name,
+                               GVariant        *parameters,
+                               gpointer         user_data)
+{
+        CsdPowerManager *manager = CSD_POWER_MANAGER (user_data);
+        gboolean active;
+
+        g_variant_get (parameters, "(b)", &active);
+        if (active)
+                screensaver_lock_done (manager, TRUE, NULL);
+}
+
+static void
+screensaver_get_active_cb (GObject      *source_object,
+                           GAsyncResult *res,
+                           gpointer      user_data)
+{
+        GVariant *result;
+        GError *error = NULL;
+        gboolean active;
+
+        result = g_dbus_connection_call_finish (G_DBUS_CONNECTION (source_object), res, &error);
+        if (result == NULL) {
+                if (!g_error_matches (error, G_IO_ERROR, G_IO_ERROR_CANCELLED))
+                        screensaver_lock_done (CSD_POWER_MANAGER (user_data), FALSE, error->message);
+                g_error_free (error);
+                return;
+        }
+
+        /* otherwise wait for ActiveChanged, or the deadline */
+        g_variant_get (result, "(b)", &active);
+        if (active)
+                screensaver_lock_done (CSD_POWER_MANAGER (user_data), TRUE, NULL);
+        g_variant_unref (result);
+}
+
+static void
+screensaver_lock_cb (GObject      *source_object,
+                     GAsyncResult *res,
+                     gpointer      user_data)
+{
+        CsdPowerManager *manager;
+        GVariant *result;
+        GError *error = NULL;
+
+        result = g_dbus_connection_call_finish (G_DBUS_CONNECTION (source_object), res, &error);
+        if (result == NULL) {
+                if (!g_error_matches (error, G_IO_ERROR, G_IO_ERROR_CANCELLED)) {
+                        g_warning ("Couldn't lock screen: %s", error->message);
+                        screensaver_lock_done (CSD_POWER_MANAGER (user_data), FALSE, error->message);
+                }
+                g_error_free (error);
+                return;
+        }
+        g_variant_unref (result);
+
+        manager = CSD_POWER_MANAGER (user_data);
+        if (!manager->priv->lock_in_progress)
+                return;
+
+        /* the screensaver may have become active before we subscribed */
+        g_dbus_connection_call (manager->priv->connection,
+                                GS_DBUS_NAME,
+                                GS_DBUS_PATH,
+                                GS_DBUS_INTERFACE,
+                                "GetActive",
+                                NULL,
+                                G_VARIANT_TYPE ("(b)"),
+                                G_DBUS_CALL_FLAGS_NONE,
+                                -1,
+                                manager->priv->lock_cancellable,
+                                screensaver_get_active_cb,
+                                manager);
+}
+
+/* Asks cinnamon-screensaver to activate, or lock, over D-Bus without
+ * blocking. Whatever is waiting for the lock is told through
+ * screensaver_lock_done(), once the screensaver reports it is active or
+ * CSD_POWER_MANAGER_LOCK_TIMEOUT has passed. */
 static void
 activate_screensaver (CsdPowerManager *manager, gboolean force_lock)
 {
-    GError *error;
-    gboolean ret;
     gchar *custom_saver = g_settings_get_string (manager->priv->settings_screensaver,
                                                  "custom-screensaver-command");
 
     g_debug ("Locking screen before sleep/hibernate");
 
     if (custom_saver && g_strcmp0 (custom_saver, "") != 0) {
+            /* the custom locker gets the inhibitor fd and holds it itself */
             lock_screen_with_custom_saver (manager, custom_saver, FALSE);
             goto quit;
     }
 
     /* if we fail to get the gsettings entry, or if the user did not select
-     * a custom screen saver, default to invoking cinnamon-screensaver */
-    /* do this sync to ensure it's on the screen when we start suspending */
-    error = NULL;
-
-    if (force_lock) {
-        ret = g_spawn_command_line_sync ("cinnamon-screensaver-command --lock", NULL, NULL, NULL, &error);
-    } else {
-        ret = g_spawn_command_line_sync ("cinnamon-screensaver-command -a", NULL, NULL, NULL, &error);
+     * a custom screen saver, default to cinnamon-screensaver */
+    if (manager->priv->connection == NULL) {
+            GError *error = NULL;
+
+            g_debug ("not connected to the session bus yet, using cinnamon-screensaver-command");
+            if (!g_spawn_command_line_async (force_lock ? "cinnamon-screensaver-command --lock" :
+                                                          "cinnamon-screensaver-command -a",
+                                             &error)) {
+                    g_warning ("Couldn't lock screen: %s", error->message);
+                    g_error_free (error);
+            }
+            goto quit;
     }
 
-    if (!ret) {
-        g_warning ("Couldn't lock screen: %s", error->message);
-        g_error_free (error);
+    if (!manager->priv->lock_in_progress) {
+            manager->priv->lock_in_progress = TRUE;
+            manager->priv->lock_start_time = g_get_monotonic_time ();
+            manager->priv->lock_cancellable = g_cancellable_new ();
+            manager->priv->lock_active_changed_id =
+                    g_dbus_connection_signal_subscribe (manager->priv->connection,
+                                                        GS_DBUS_NAME,
+                                                        GS_DBUS_INTERFACE,
+                                                        "ActiveChanged",
+                                                        GS_DBUS_PATH,
+                                                        NULL,
+                                                        G_DBUS_SIGNAL_FLAGS_NONE,
+                                                        screensaver_active_changed_cb,
+                                                        manager,
+                                                        NULL);
+            manager->priv->lock_timeout_id = g_timeout_add (CSD_POWER_MANAGER_LOCK_TIMEOUT,
+                                                            (GSourceFunc) screensaver_lock_timeout_cb,
+                                                            manager);
+            g_source_set_name_by_id (manager->priv->lock_timeout_id, "[CsdPowerManager] screen lock deadline");
     }
 
+    g_dbus_connection_call (manager->priv->connection,
+                            GS_DBUS_NAME,
+                            GS_DBUS_PATH,
+                            GS_DBUS_INTERFACE,
+                            force_lock ? "Lock" : "SetActive",
+                            force_lock ? g_variant_new ("(s)", "") : g_variant_new ("(b)", TRUE),
+                            NULL,
+                            G_DBUS_CALL_FLAGS_NONE,
+                            CSD_POWER_MANAGER_LOCK_TIMEOUT,
+                            manager->priv->lock_cancellable,
+                            screensaver_lock_cb,
+                            manager);
+
 quit:
     g_free (custom_saver);
 }
@@ -3963,11 +4475,17 @@ handle_suspend_actions (CsdPowerManager *manager)
          * applet.  Lock is handled there as well... but just in case I
          * suppose.)
          */
+        manager->priv->suspend_announced_time = g_get_monotonic_time ();
+
         if (should_lock_on_suspend (manager)) {
             activate_screensaver (manager, TRUE);
         }
 
-        /* lift the delay inhibit, so logind can proceed */
+        /* lift the delay inhibit once locked, so logind can proceed */
+        if (manager->priv->lock_in_progress) {
+                manager->priv->lock_then_uninhibit = TRUE;
+                return;
+        }
         uninhibit_suspend (manager);
 }
 
@@ -4115,6 +4633,10 @@ on_rr_screen_acquired (GObject      *object,
         manager->priv->kbd_brightness_old = -1;
         manager->priv->kbd_brightness_pre_dim = -1;
         manager->priv->pre_dim_brightness = -1;
+        brightness_fade_init (manager, &manager->priv->display_fade,
+                              "display", backlight_fade_write);
+        brightness_fade_init (manager, &manager->priv->kbd_fade,
+                              "keyboard", upower_kbd_fade_write);
         g_signal_connect (manager->priv->settings, "changed",
                           G_CALLBACK (engine_settings_key_changed_cb), manager);
         g_signal_connect (manager->priv->settings_desktop_session, "changed",
@@ -4195,6 +4717,9 @@ on_rr_screen_acquired (GObject      *object,
 
         /* get backlight setting overrides */
         manager->priv->backlight_helper_preference_args = NULL;
+        manager->priv->backlight = gpm_backlight_new ();
+        g_signal_connect (manager->priv->backlight, "brightness-changed",
+                          G_CALLBACK (backlight_brightness_changed_cb), manager);
         backlight_override_settings_refresh (manager);
 
         /* get percentage policy */
@@ -4288,6 +4813,8 @@ csd_power_manager_start (CsdPowerManager *manager,
         manager->priv->settings_desktop_session = g_settings_new (CSD_SESSION_SETTINGS_SCHEMA);
         manager->priv->settings_cinnamon_session = g_settings_new (CSD_CINNAMON_SESSION_SCHEMA);
         manager->priv->devices_array = g_ptr_array_new_with_free_func (g_object_unref);
+        manager->priv->devices_dirty = g_hash_table_new_full (g_direct_hash, g_direct_equal,
+                                                              g_object_unref, NULL);
 
         cinnamon_settings_profile_end (NULL);
 
@@ -4307,6 +4834,15 @@ csd_power_manager_stop (CsdPowerManager *manager)
 
         kill_lid_close_safety_timer (manager);
 
+        brightness_fade_stop (&manager->priv->display_fade);
+        brightness_fade_stop (&manager->priv->kbd_fade);
+
+        if (manager->priv->lock_cancellable != NULL)
+                g_cancellable_cancel (manager->priv->lock_cancellable);
+        manager->priv->lock_then_blank = FALSE;
+        manager->priv->lock_then_uninhibit = FALSE;
+        screensaver_lock_done (manager, FALSE, "power manager stopped");
+
         g_signal_handlers_disconnect_by_data (manager->priv->up_client, manager);
 
         if (manager->priv->connection != NULL) {
@@ -4367,11 +4903,25 @@ csd_power_manager_stop (CsdPowerManager *manager)
 
         g_free (manager->priv->backlight_helper_preference_args);
         manager->priv->backlight_helper_preference_args = NULL;
+        if (manager->priv->backlight != NULL) {
+                g_signal_handlers_disconnect_by_data (manager->priv->backlight, manager);
+                g_clear_object (&manager->priv->backlight);
+        }
 
         if (manager->priv->x11_screen != NULL) {
+                g_signal_handlers_disconnect_by_func (manager->priv->x11_screen, on_randr_event, manager);
                 g_object_unref (manager->priv->x11_screen);
                 manager->priv->x11_screen = NULL;
         }
+        manager->priv->randr_external_on = 0;
+
+        if (manager->priv->devices_changed_id != 0) {
+                g_source_remove (manager->priv->devices_changed_id);
+                manager->priv->devices_changed_id = 0;
+        }
+        g_clear_pointer (&manager->priv->devices_dirty, g_hash_table_unref);
+        g_clear_pointer (&manager->priv->devices_blob, g_variant_unref);
+        memset (manager->priv->composite_totals, 0, sizeof (manager->priv->composite_totals));
 
         g_ptr_array_unref (manager->priv->devices_array);
         manager->priv->devices_array = NULL;
@@ -4521,6 +5071,21 @@ device_to_variant_blob (UpDevice *device)
         return value;
 }
 
+/* returns a new reference to the cached, non-floating blob */
+static GVariant *
+device_get_variant_blob (UpDevice *device)
+{
+        GVariant *value;
+
+        value = g_object_get_data (G_OBJECT (device), "engine-variant-blob");
+        if (value == NULL) {
+                value = g_variant_ref_sink (device_to_variant_blob (device));
+                g_object_set_data_full (G_OBJECT (device), "engine-variant-blob",
+                                        value, (GDestroyNotify) g_variant_unref);
+        }
+        return g_variant_ref (value);
+}
+
 /* returns new level */
 static void
 handle_method_call_keyboard (CsdPowerManager *manager,
@@ -4534,6 +5099,8 @@ handle_method_call_keyboard (CsdPowerManager *manager,
         guint percentage;
         GError *error = NULL;
 
+        brightness_fade_stop (&manager->priv->kbd_fade);
+
         if (manager->priv->kbd_brightness_max == 0) {
                 error = g_error_new (CSD_POWER_MANAGER_ERROR,
                                      CSD_POWER_MANAGER_ERROR_NOT_SUPPORTED,
@@ -4746,9 +5313,10 @@ power_iface_handle_get_primary_device (CsdPower              *object,
         }
 
         /* return the value */
-        value = device_to_variant_blob (device);
+        value = device_get_variant_blob (device);
         tuple = g_variant_new_tuple (&value, 1);
         g_dbus_method_invocation_return_value (invocation, tuple);
+        g_variant_unref (value);
         g_object_unref (device);
 
         return TRUE;
@@ -4769,6 +5337,10 @@ power_iface_handle_get_devices (CsdPower              *object,
 
         g_debug ("Handling Power interface method GetDevices");
 
+        /* nothing changed since the last call */
+        if (manager->priv->devices_blob != NULL)
+                goto out;
+
         /* create builder */
         builder = g_variant_builder_new (G_VARIANT_TYPE("a(sssusduut)"));
 
@@ -4776,15 +5348,18 @@ power_iface_handle_get_devices (CsdPower              *object,
         array = manager->priv->devices_array;
         for (i=0; i<array->len; i++) {
                 device = g_ptr_array_index (array, i);
-                value = device_to_variant_blob (device);
+                value = device_get_variant_blob (device);
                 g_variant_builder_add_value (builder, value);
+                g_variant_unref (value);
         }
 
+        manager->priv->devices_blob = g_variant_ref_sink (g_variant_builder_end (builder));
+        g_variant_builder_unref (builder);
+out:
         /* return the value */
-        value = g_variant_builder_end (builder);
+        value = manager->priv->devices_blob;
         tuple = g_variant_new_tuple (&value, 1);
         g_dbus_method_invocation_return_value (invocation, tuple);
-        g_variant_builder_unref (builder);
 
         return TRUE;
 }
@@ -0,0 +1,577 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: nil; c-basic-offset: 8 -*-
+ *
+ * Licensed under the GNU General Public License Version 2
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include "config.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+#include <glib.h>
+#include <gio/gio.h>
+
+#ifdef HAVE_GUDEV
+#include <gudev/gudev.h>
+#endif
+
+#include "gpm-backlight.h"
+
+#define LOGIND_DBUS_NAME                        "org.freedesktop.login1"
+#define LOGIND_DBUS_SESSION_PATH                "/org/freedesktop/login1/session/auto"
+#define LOGIND_DBUS_SESSION_INTERFACE           "org.freedesktop.login1.Session"
+
+#define GPM_BACKLIGHT_GET_PRIVATE(o) (G_TYPE_INSTANCE_GET_PRIVATE ((o), GPM_BACKLIGHT_TYPE, GpmBacklightPrivate))
+
+/*
+ * The sysfs brightness attributes are world readable, so only writes need
+ * privileges.  We resolve the device once, keep its brightness attribute
+ * open and cache max_brightness, and hand writes to logind's
+ * Session.SetBrightness() asynchronously.  If logind is too old to have that
+ * method we fall back to an async pkexec of csd-backlight-helper; other
+ * logind errors only send the failed write through the helper.
+ *
+ * While a write is in flight further requests are coalesced, so holding
+ * down the brightness key never queues up more than one pending write.
+ *
+ * The current level is tracked from udev "change" events on the backlight
+ * subsystem, so reads are served from memory.  Backlight devices coming and
+ * going make us re-run the device selection.
+ */
+struct GpmBacklightPrivate
+{
+        gchar                   *type;
+        gchar                   *name;
+        gchar                  **preference_order;
+        gint                     brightness_fd;
+        gint                     max_brightness;
+        gint                     brightness;
+        gint                     brightness_target;
+        gboolean                 write_in_flight;
+        gint                     write_pending;
+        gboolean                 use_logind;
+        GDBusConnection         *system_bus;
+        GCancellable            *cancellable;
+#ifdef HAVE_GUDEV
+        GUdevClient             *udev_client;
+#endif
+};
+
+enum {
+        SIGNAL_BRIGHTNESS_CHANGED,
+        LAST_SIGNAL
+};
+
+static guint signals [LAST_SIGNAL] = { 0 };
+
+static void     gpm_backlight_finalize          (GObject        *object);
+static void     gpm_backlight_write_start       (GpmBacklight   *backlight,
+                                                 gint            value);
+
+G_DEFINE_TYPE (GpmBacklight, gpm_backlight, G_TYPE_OBJECT)
+
+static void
+gpm_backlight_clear_device (GpmBacklight *backlight)
+{
+        if (backlight->priv->brightness_fd >= 0) {
+                close (backlight->priv->brightness_fd);
+                backlight->priv->brightness_fd = -1;
+        }
+        g_clear_pointer (&backlight->priv->type, g_free);
+        g_clear_pointer (&backlight->priv->name, g_free);
+        backlight->priv->max_brightness = -1;
+        backlight->priv->brightness = -1;
+        backlight->priv->brightness_target = -1;
+
+        /* a write still in flight finishes, but nothing follows it */
+        backlight->priv->write_pending = -1;
+}
+
+static gint
+gpm_backlight_read_brightness (GpmBacklight *backlight, GError **error)
+{
+        gchar buf[32];
+        gchar *endptr = NULL;
+        gssize len;
+        gint64 value;
+
+        len = pread (backlight->priv->brightness_fd, buf, sizeof (buf) - 1, 0);
+        if (len <= 0) {
+                g_set_error (error, G_IO_ERROR, g_io_error_from_errno (errno),
+                             "failed to read backlight brightness: %s",
+                             len < 0 ? g_strerror (errno) : "empty file");
+                return -1;
+        }
+        buf[len] = '\0';
+
+        value = g_ascii_strtoll (buf, &endptr, 10);
+        if (endptr == buf || value < 0 || value > G_MAXINT) {
+                g_set_error (error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA,
+                             "failed to parse brightness: %s", buf);
+                return -1;
+        }
+
+        return value;
+}
+
+#ifdef HAVE_GUDEV
+/* same search as csd_backlight_helper_get_best_backlight() */
+static GUdevDevice *
+gpm_backlight_find_best_device (GList *devices, gchar **preference_order)
+{
+        const gchar *type;
+        GList *d;
+        guint i;
+
+        for (i = 0; preference_order[i] != NULL; i++) {
+                for (d = devices; d != NULL; d = d->next) {
+                        type = g_udev_device_get_sysfs_attr (d->data, "type");
+                        if (g_strcmp0 (type, preference_order[i]) == 0)
+                                return d->data;
+                }
+        }
+        return NULL;
+}
+#endif
+
+static void
+gpm_backlight_resolve_device (GpmBacklight *backlight)
+{
+#ifdef HAVE_GUDEV
+        GUdevDevice *device;
+        GList *devices;
+        gchar *filename = NULL;
+        GError *error = NULL;
+
+        gpm_backlight_clear_device (backlight);
+
+        if (backlight->priv->preference_order == NULL ||
+            backlight->priv->preference_order[0] == NULL)
+                return;
+
+        devices = g_udev_client_query_by_subsystem (backlight->priv->udev_client, "backlight");
+        device = gpm_backlight_find_best_device (devices, backlight->priv->preference_order);
+        if (device == NULL) {
+                g_debug ("no backlight device matches the preference order");
+                goto out;
+        }
+
+        backlight->priv->max_brightness = g_udev_device_get_sysfs_attr_as_int (device, "max_brightness");
+        if (backlight->priv->max_brightness <= 0) {
+                g_warning ("backlight %s has no usable max_brightness",
+                           g_udev_device_get_sysfs_path (device));
+                goto out;
+        }
+
+        filename = g_build_filename (g_udev_device_get_sysfs_path (device), "brightness", NULL);
+        backlight->priv->brightness_fd = open (filename, O_RDONLY | O_CLOEXEC);
+        if (backlight->priv->brightness_fd < 0) {
+                g_warning ("failed to open %s: %s", filename, g_strerror (errno));
+                goto out;
+        }
+
+        backlight->priv->brightness = gpm_backlight_read_brightness (backlight, &error);
+        if (backlight->priv->brightness < 0) {
+                g_warning ("%s", error->message);
+                g_error_free (error);
+                goto out;
+        }
+
+        backlight->priv->type = g_strdup (g_udev_device_get_sysfs_attr (device, "type"));
+        backlight->priv->name = g_strdup (g_udev_device_get_name (device));
+        g_debug ("using backlight %s (%s), max brightness %i",
+                 backlight->priv->name,
+                 backlight->priv->type,
+                 backlight->priv->max_brightness);
+out:
+        if (backlight->priv->name == NULL)
+                gpm_backlight_clear_device (backlight);
+        g_free (filename);
+        g_list_free_full (devices, g_object_unref);
+#endif
+}
+
+#ifdef HAVE_GUDEV
+static void
+gpm_backlight_uevent_cb (GUdevClient  *client,
+                         const gchar  *action,
+                         GUdevDevice  *device,
+                         GpmBacklight *backlight)
+{
+        GError *error = NULL;
+        gint value;
+
+        if (g_strcmp0 (action, "add") == 0 ||
+            g_strcmp0 (action, "remove") == 0) {
+                g_debug ("backlight %s %s, re-resolving device",
+                         g_udev_device_get_name (device), action);
+                gpm_backlight_resolve_device (backlight);
+                return;
+        }
+
+        if (g_strcmp0 (action, "change") != 0 ||
+            g_strcmp0 (g_udev_device_get_name (device), backlight->priv->name) != 0)
+                return;
+
+        value = gpm_backlight_read_brightness (backlight, &error);
+        if (value < 0) {
+                g_warning ("%s", error->message);
+                g_error_free (error);
+                return;
+        }
+
+        if (value == backlight->priv->brightness)
+                return;
+        backlight->priv->brightness = value;
+
+        /* our own writes are reported by the caller, only signal
+         * changes made behind our back, e.g. by firmware hotkeys */
+        if (backlight->priv->write_in_flight ||
+            value == backlight->priv->brightness_target)
+                return;
+
+        backlight->priv->brightness_target = value;
+        g_signal_emit (backlight, signals [SIGNAL_BRIGHTNESS_CHANGED], 0, value);
+}
+#endif
+
+/**
+ * gpm_backlight_set_preference_order:
+ *
+ * Re-resolves the backlight device, using the same "type" preference
+ * order as the backlight-helper-preference-order setting.
+ **/
+void
+gpm_backlight_set_preference_order (GpmBacklight *backlight,
+                                    gchar **preference_order)
+{
+        g_return_if_fail (GPM_IS_BACKLIGHT (backlight));
+
+        g_strfreev (backlight->priv->preference_order);
+        backlight->priv->preference_order = g_strdupv (preference_order);
+        gpm_backlight_resolve_device (backlight);
+}
+
+gboolean
+gpm_backlight_is_available (GpmBacklight *backlight)
+{
+        g_return_val_if_fail (GPM_IS_BACKLIGHT (backlight), FALSE);
+
+        return backlight->priv->name != NULL;
+}
+
+gint
+gpm_backlight_get_max_brightness (GpmBacklight *backlight)
+{
+        g_return_val_if_fail (GPM_IS_BACKLIGHT (backlight), -1);
+
+        return backlight->priv->max_brightness;
+}
+
+/**
+ * gpm_backlight_get_brightness:
+ *
+ * Gets the current brightness level from the udev-tracked cache. While a
+ * write is still outstanding the requested level is returned, so that
+ * consecutive steps build on each other rather than on the stale
+ * hardware value.
+ *
+ * Return value: the brightness level, or -1 for failure. If -1 then
+ * @error is set.
+ **/
+gint
+gpm_backlight_get_brightness (GpmBacklight *backlight, GError **error)
+{
+        g_return_val_if_fail (GPM_IS_BACKLIGHT (backlight), -1);
+
+        if (backlight->priv->brightness_fd < 0) {
+                g_set_error_literal (error, G_IO_ERROR, G_IO_ERROR_NOT_FOUND,
+                                     "No backlight device available");
+                return -1;
+        }
+
+        if (backlight->priv->write_in_flight)
+                return backlight->priv->brightness_target;
+
+        return backlight->priv->brightness;
+}
+
+static void
+gpm_backlight_write_done (GpmBacklight *backlight)
+{
+        gint value;
+
+        backlight->priv->write_in_flight = FALSE;
+
+        /* send the newest level requested while we were busy */
+        if (backlight->priv->write_pending >= 0 && backlight->priv->name != NULL) {
+                value = backlight->priv->write_pending;
+                backlight->priv->write_pending = -1;
+                gpm_backlight_write_start (backlight, value);
+                return;
+        }
+
+        /* resync in case the driver does not send change events */
+        if (backlight->priv->brightness_fd >= 0) {
+                value = gpm_backlight_read_brightness (backlight, NULL);
+                if (value >= 0)
+                        backlight->priv->brightness = value;
+        }
+}
+
+static void
+gpm_backlight_helper_done_cb (GObject      *source_object,
+                              GAsyncResult *res,
+                              gpointer      user_data)
+{
+        GpmBacklight *backlight;
+        GError *error = NULL;
+
+        if (!g_subprocess_wait_check_finish (G_SUBPROCESS (source_object), res, &error)) {
+                if (g_error_matches (error, G_IO_ERROR, G_IO_ERROR_CANCELLED)) {
+                        g_error_free (error);
+                        return;
+                }
+                g_warning ("csd-backlight-helper failed: %s", error->message);
+                g_error_free (error);
+        }
+
+        backlight = GPM_BACKLIGHT (user_data);
+        gpm_backlight_write_done (backlight);
+}
+
+static void
+gpm_backlight_helper_write (GpmBacklight *backlight, gint value)
+{
+        GSubprocess *subprocess;
+        GError *error = NULL;
+        gchar *value_str;
+
+        /* the device went away while logind was busy */
+        if (backlight->priv->type == NULL || value < 0) {
+                gpm_backlight_write_done (backlight);
+                return;
+        }
+
+        value_str = g_strdup_printf ("%i", value);
+        subprocess = g_subprocess_new (G_SUBPROCESS_FLAGS_STDOUT_SILENCE,
+                                       &error,
+                                       "pkexec",
+                                       LIBEXECDIR "/csd-backlight-helper",
+                                       "--set-brightness", value_str,
+                                       "-b", backlight->priv->type,
+                                       NULL);
+        g_free (value_str);
+
+        if (subprocess == NULL) {
+                g_warning ("failed to run csd-backlight-helper: %s", error->message);
+                g_error_free (error);
+                gpm_backlight_write_done (backlight);
+                return;
+        }
+
+        g_subprocess_wait_check_async (subprocess,
+                                       backlight->priv->cancellable,
+                                       gpm_backlight_helper_done_cb,
+                                       backlight);
+        g_object_unref (subprocess);
+}
+
+static void
+gpm_backlight_logind_done_cb (GObject      *source_object,
+                              GAsyncResult *res,
+                              gpointer      user_data)
+{
+        GpmBacklight *backlight;
+        GVariant *result;
+        GError *error = NULL;
+
+        result = g_dbus_connection_call_finish (G_DBUS_CONNECTION (source_object), res, &error);
+        if (result == NULL) {
+                if (g_error_matches (error, G_IO_ERROR, G_IO_ERROR_CANCELLED)) {
+                        g_error_free (error);
+                        return;
+                }
+
+                backlight = GPM_BACKLIGHT (user_data);
+
+                /* logind < 243 has no SetBrightness, use the helper from now
+                 * on; any other failure may be transient, so only this write
+                 * goes through the helper */
+                if (g_error_matches (error, G_DBUS_ERROR, G_DBUS_ERROR_UNKNOWN_METHOD) ||
+                    g_error_matches (error, G_DBUS_ERROR, G_DBUS_ERROR_UNKNOWN_INTERFACE) ||
+                    g_error_matches (error, G_DBUS_ERROR, G_DBUS_ERROR_SERVICE_UNKNOWN)) {
+                        g_debug ("logind has no SetBrightness, falling back to csd-backlight-helper: %s",
+                                 error->message);
+                        backlight->priv->use_logind = FALSE;
+                } else {
+                        g_debug ("logind SetBrightness failed, retrying with csd-backlight-helper: %s",
+                                 error->message);
+                }
+                g_error_free (error);
+                backlight->priv->write_pending = -1;
+                gpm_backlight_helper_write (backlight, backlight->priv->brightness_target);
+                return;
+        }
+        g_variant_unref (result);
+
+        backlight = GPM_BACKLIGHT (user_data);
+        gpm_backlight_write_done (backlight);
+}
+
+static void
+gpm_backlight_write_start (GpmBacklight *backlight, gint value)
+{
+        if (backlight->priv->name == NULL || value < 0)
+                return;
+
+        backlight->priv->write_in_flight = TRUE;
+        backlight->priv->brightness_target = value;
+
+        if (backlight->priv->use_logind && backlight->priv->system_bus != NULL) {
+                g_dbus_connection_call (backlight->priv->system_bus,
+                                        LOGIND_DBUS_NAME,
+                                        LOGIND_DBUS_SESSION_PATH,
+                                        LOGIND_DBUS_SESSION_INTERFACE,
+                                        "SetBrightness",
+                                        g_variant_new ("(ssu)",
+                                                       "backlight",
+                                                       backlight->priv->name,
+                                                       (guint32) value),
+                                        NULL,
+                                        G_DBUS_CALL_FLAGS_NONE,
+                                        -1,
+                                        backlight->priv->cancellable,
+                                        gpm_backlight_logind_done_cb,
+                                        backlight);
+                return;
+        }
+
+        gpm_backlight_helper_write (backlight, value);
+}
+
+/**
+ * gpm_backlight_set_brightness:
+ *
+ * Requests a new brightness level. The write happens asynchronously and
+ * this function returns as soon as it has been queued.
+ *
+ * Return value: Success. If FALSE then @error is set.
+ **/
+gboolean
+gpm_backlight_set_brightness (GpmBacklight *backlight,
+                              gint value,
+                              GError **error)
+{
+        g_return_val_if_fail (GPM_IS_BACKLIGHT (backlight), FALSE);
+
+        if (backlight->priv->name == NULL) {
+                g_set_error_literal (error, G_IO_ERROR, G_IO_ERROR_NOT_FOUND,
+                                     "No backlight device available");
+                return FALSE;
+        }
+
+        value = CLAMP (value, 0, backlight->priv->max_brightness);
+
+        if (backlight->priv->write_in_flight) {
+                backlight->priv->brightness_target = value;
+                backlight->priv->write_pending = value;
+                return TRUE;
+        }
+
+        gpm_backlight_write_start (backlight, value);
+        return TRUE;
+}
+
+static void
+gpm_backlight_class_init (GpmBacklightClass *klass)
+{
+        GObjectClass *object_class = G_OBJECT_CLASS (klass);
+        object_class->finalize = gpm_backlight_finalize;
+        g_type_class_add_private (klass, sizeof (GpmBacklightPrivate));
+
+        signals [SIGNAL_BRIGHTNESS_CHANGED] =
+                g_signal_new ("brightness-changed",
+                              G_TYPE_FROM_CLASS (object_class),
+                              G_SIGNAL_RUN_LAST,
+                              G_STRUCT_OFFSET (GpmBacklightClass, brightness_changed),
+                              NULL, NULL, g_cclosure_marshal_VOID__INT,
+                              G_TYPE_NONE, 1, G_TYPE_INT);
+}
+
+static void
+gpm_backlight_init (GpmBacklight *backlight)
+{
+#ifdef HAVE_GUDEV
+        const gchar * const subsystems[] = { "backlight", NULL };
+#endif
+        GError *error = NULL;
+
+        backlight->priv = GPM_BACKLIGHT_GET_PRIVATE (backlight);
+
+        backlight->priv->brightness_fd = -1;
+        backlight->priv->max_brightness = -1;
+        backlight->priv->brightness = -1;
+        backlight->priv->brightness_target = -1;
+        backlight->priv->write_pending = -1;
+        backlight->priv->use_logind = TRUE;
+        backlight->priv->cancellable = g_cancellable_new ();
+
+        backlight->priv->system_bus = g_bus_get_sync (G_BUS_TYPE_SYSTEM, NULL, &error);
+        if (backlight->priv->system_bus == NULL) {
+                g_warning ("failed to connect to the system bus: %s", error->message);
+                g_error_free (error);
+        }
+
+#ifdef HAVE_GUDEV
+        backlight->priv->udev_client = g_udev_client_new (subsystems);
+        g_signal_connect (backlight->priv->udev_client, "uevent",
+                          G_CALLBACK (gpm_backlight_uevent_cb), backlight);
+#endif
+}
+
+static void
+gpm_backlight_finalize (GObject *object)
+{
+        GpmBacklight *backlight;
+
+        g_return_if_fail (object != NULL);
+        g_return_if_fail (GPM_IS_BACKLIGHT (object));
+
+        backlight = GPM_BACKLIGHT (object);
+
+        g_cancellable_cancel (backlight->priv->cancellable);
+        g_clear_object (&backlight->priv->cancellable);
+        g_clear_object (&backlight->priv->system_bus);
+#ifdef HAVE_GUDEV
+        if (backlight->priv->udev_client != NULL) {
+                g_signal_handlers_disconnect_by_data (backlight->priv->udev_client, backlight);
+                g_clear_object (&backlight->priv->udev_client);
+        }
+#endif
+        gpm_backlight_clear_device (backlight);
+        g_strfreev (backlight->priv->preference_order);
+
+        G_OBJECT_CLASS (gpm_backlight_parent_class)->finalize (object);
+}
+
+GpmBacklight *
+gpm_backlight_new (void)
+{
+        return g_object_new (GPM_BACKLIGHT_TYPE, NULL);
+}
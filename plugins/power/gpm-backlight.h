@@ -0,0 +1,64 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: nil; c-basic-offset: 8 -*-
+ *
+ * Licensed under the GNU General Public License Version 2
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef __GPM_BACKLIGHT_H
+#define __GPM_BACKLIGHT_H
+
+#include <glib-object.h>
+
+G_BEGIN_DECLS
+
+#define GPM_BACKLIGHT_TYPE              (gpm_backlight_get_type ())
+#define GPM_BACKLIGHT(o)                (G_TYPE_CHECK_INSTANCE_CAST ((o), GPM_BACKLIGHT_TYPE, GpmBacklight))
+#define GPM_BACKLIGHT_CLASS(k)          (G_TYPE_CHECK_CLASS_CAST((k), GPM_BACKLIGHT_TYPE, GpmBacklightClass))
+#define GPM_IS_BACKLIGHT(o)             (G_TYPE_CHECK_INSTANCE_TYPE ((o), GPM_BACKLIGHT_TYPE))
+#define GPM_IS_BACKLIGHT_CLASS(k)       (G_TYPE_CHECK_CLASS_TYPE ((k), GPM_BACKLIGHT_TYPE))
+#define GPM_BACKLIGHT_GET_CLASS(o)      (G_TYPE_INSTANCE_GET_CLASS ((o), GPM_BACKLIGHT_TYPE, GpmBacklightClass))
+
+typedef struct GpmBacklightPrivate GpmBacklightPrivate;
+
+typedef struct
+{
+        GObject                  parent;
+        GpmBacklightPrivate     *priv;
+} GpmBacklight;
+
+typedef struct
+{
+        GObjectClass    parent_class;
+        void            (* brightness_changed)          (GpmBacklight   *backlight,
+                                                         gint            value);
+} GpmBacklightClass;
+
+GType            gpm_backlight_get_type                 (void);
+GpmBacklight    *gpm_backlight_new                      (void);
+
+void             gpm_backlight_set_preference_order     (GpmBacklight   *backlight,
+                                                         gchar         **preference_order);
+gboolean         gpm_backlight_is_available             (GpmBacklight   *backlight);
+gint             gpm_backlight_get_max_brightness       (GpmBacklight   *backlight);
+gint             gpm_backlight_get_brightness           (GpmBacklight   *backlight,
+                                                         GError        **error);
+gboolean         gpm_backlight_set_brightness           (GpmBacklight   *backlight,
+                                                         gint            value,
+                                                         GError        **error);
+
+G_END_DECLS
+
+#endif  /* __GPM_BACKLIGHT_H */
@@ -39,21 +39,32 @@ static void     gpm_idletime_finalize   (GObject       *object);
 
 #define GPM_IDLETIME_GET_PRIVATE(o) (G_TYPE_INSTANCE_GET_PRIVATE ((o), GPM_IDLETIME_TYPE, GpmIdletimePrivate))
 
+/*
+ * Rather than one XSync alarm per idle stage we keep the stages sorted by
+ * timeout and only ever arm two alarms: a positive transition at the
+ * next stage that has not expired yet, and a negative transition that
+ * tells us the user is back.  Stepping through the stages or resetting
+ * them therefore costs the same number of X requests however many
+ * stages are configured.
+ */
 struct GpmIdletimePrivate
 {
         gint                     sync_event;
         gboolean                 reset_set;
         XSyncCounter             idle_counter;
-        GPtrArray               *array;
+        GPtrArray               *array;         /* sorted by timeout */
+        guint                    next_index;    /* first stage that has not expired */
+        gint64                   expired_value; /* counter value of the last expiry */
+        XSyncAlarm               stage_xalarm;
+        gint64                   stage_value;   /* what stage_xalarm is armed at, or -1 */
+        XSyncAlarm               reset_xalarm;
         Display                 *dpy;
 };
 
 typedef struct
 {
         guint                    id;
-        XSyncValue               timeout;
-        XSyncAlarm               xalarm;
-        GpmIdletime             *idletime;
+        gint64                   timeout;
 } GpmIdletimeAlarm;
 
 enum {
@@ -101,7 +112,8 @@ gpm_idletime_get_time (GpmIdletime *idletime)
 
 static void
 gpm_idletime_xsync_alarm_set (GpmIdletime *idletime,
-                              GpmIdletimeAlarm *alarm_item,
+                              XSyncAlarm *xalarm,
+                              XSyncValue wait_value,
                               GpmIdletimeAlarmType alarm_type)
 {
         XSyncAlarmAttributes attr;
@@ -111,10 +123,9 @@ gpm_idletime_xsync_alarm_set (GpmIdletime *idletime,
 
         /* just remove it */
         if (alarm_type == GPM_IDLETIME_ALARM_TYPE_DISABLED) {
-                if (alarm_item->xalarm) {
-                        XSyncDestroyAlarm (idletime->priv->dpy,
-                                           alarm_item->xalarm);
-                        alarm_item->xalarm = None;
+                if (*xalarm) {
+                        XSyncDestroyAlarm (idletime->priv->dpy, *xalarm);
+                        *xalarm = None;
                 }
                 return;
         }
@@ -130,7 +141,7 @@ gpm_idletime_xsync_alarm_set (GpmIdletime *idletime,
         attr.trigger.counter = idletime->priv->idle_counter;
         attr.trigger.value_type = XSyncAbsolute;
         attr.trigger.test_type = test;
-        attr.trigger.wait_value = alarm_item->timeout;
+        attr.trigger.wait_value = wait_value;
         attr.delta = delta;
 
         flags = XSyncCACounter |
@@ -139,41 +150,96 @@ gpm_idletime_xsync_alarm_set (GpmIdletime *idletime,
                 XSyncCAValue |
                 XSyncCADelta;
 
-        if (alarm_item->xalarm) {
+        if (*xalarm) {
                 XSyncChangeAlarm (idletime->priv->dpy,
-                                  alarm_item->xalarm,
+                                  *xalarm,
                                   flags,
                                   &attr);
         } else {
-                alarm_item->xalarm = XSyncCreateAlarm (idletime->priv->dpy,
-                                                       flags,
-                                                       &attr);
+                *xalarm = XSyncCreateAlarm (idletime->priv->dpy,
+                                            flags,
+                                            &attr);
+        }
+}
+
+/* arms the stage alarm at the next stage, if it isn't already */
+static void
+gpm_idletime_stage_arm (GpmIdletime *idletime)
+{
+        GpmIdletimeAlarm *alarm_item;
+        XSyncValue wait_value;
+
+        if (!idletime->priv->idle_counter)
+                return;
+
+        /* every stage has expired, nothing to wait for until the reset */
+        if (idletime->priv->next_index >= idletime->priv->array->len) {
+                XSyncIntToValue (&wait_value, 0);
+                gpm_idletime_xsync_alarm_set (idletime,
+                                              &idletime->priv->stage_xalarm,
+                                              wait_value,
+                                              GPM_IDLETIME_ALARM_TYPE_DISABLED);
+                idletime->priv->stage_value = -1;
+                return;
+        }
+
+        alarm_item = g_ptr_array_index (idletime->priv->array, idletime->priv->next_index);
+        if (idletime->priv->stage_value == alarm_item->timeout)
+                return;
+
+        XSyncIntToValue (&wait_value, (gint) alarm_item->timeout);
+        gpm_idletime_xsync_alarm_set (idletime,
+                                      &idletime->priv->stage_xalarm,
+                                      wait_value,
+                                      GPM_IDLETIME_ALARM_TYPE_POSITIVE);
+        idletime->priv->stage_value = alarm_item->timeout;
+}
+
+/* works out the next stage after the stage list changed */
+static void
+gpm_idletime_stage_update (GpmIdletime *idletime)
+{
+        GpmIdletimeAlarm *alarm_item;
+        gint64 expired;
+
+        /* stages we are already past can no longer transition
+         * positively, so skip them like the old per-stage alarms would
+         * have stayed silent; this also holds while the expiry signal
+         * is being emitted, before the reset alarm is set */
+        expired = MAX (idletime->priv->expired_value,
+                       gpm_idletime_get_time (idletime));
+
+        idletime->priv->next_index = 0;
+        while (idletime->priv->next_index < idletime->priv->array->len) {
+                alarm_item = g_ptr_array_index (idletime->priv->array, idletime->priv->next_index);
+                if (alarm_item->timeout > expired)
+                        break;
+                idletime->priv->next_index++;
         }
+
+        gpm_idletime_stage_arm (idletime);
 }
 
 void
 gpm_idletime_alarm_reset_all (GpmIdletime *idletime)
 {
-        guint i;
-        GpmIdletimeAlarm *alarm_item;
+        XSyncValue wait_value;
 
         g_return_if_fail (GPM_IS_IDLETIME (idletime));
 
         if (!idletime->priv->reset_set)
                 return;
 
-        /* reset all the alarms (except the reset alarm) to their timeouts */
-        for (i=1; i < idletime->priv->array->len; i++) {
-                alarm_item = g_ptr_array_index (idletime->priv->array, i);
-                gpm_idletime_xsync_alarm_set (idletime,
-                                              alarm_item,
-                                              GPM_IDLETIME_ALARM_TYPE_POSITIVE);
-        }
+        /* wait for the first stage again */
+        idletime->priv->next_index = 0;
+        idletime->priv->expired_value = -1;
+        gpm_idletime_stage_arm (idletime);
 
         /* set the reset alarm to be disabled */
-        alarm_item = g_ptr_array_index (idletime->priv->array, 0);
+        XSyncIntToValue (&wait_value, 0);
         gpm_idletime_xsync_alarm_set (idletime,
-                                      alarm_item,
+                                      &idletime->priv->reset_xalarm,
+                                      wait_value,
                                       GPM_IDLETIME_ALARM_TYPE_DISABLED);
 
         /* emit signal so say we've reset all timers */
@@ -200,18 +266,16 @@ static void
 gpm_idletime_set_reset_alarm (GpmIdletime *idletime,
                               XSyncAlarmNotifyEvent *alarm_event)
 {
-        GpmIdletimeAlarm *alarm_item;
         int overflow;
         XSyncValue add;
+        XSyncValue wait_value;
         gint64 current, reset_threshold;
 
-        alarm_item = gpm_idletime_alarm_find_id (idletime, 0);
-
         if (!idletime->priv->reset_set) {
                 /* don't match on the current value because
                  * XSyncNegativeComparison means less or equal. */
                 XSyncIntToValue (&add, -1);
-                XSyncValueAdd (&alarm_item->timeout,
+                XSyncValueAdd (&wait_value,
                               alarm_event->counter_value,
                               add,
                               &overflow);
@@ -219,7 +283,8 @@ gpm_idletime_set_reset_alarm (GpmIdletime *idletime,
                 /* set the reset alarm to fire the next time
                  * idletime->priv->idle_counter < the current counter value */
                 gpm_idletime_xsync_alarm_set (idletime,
-                                              alarm_item,
+                                              &idletime->priv->reset_xalarm,
+                                              wait_value,
                                               GPM_IDLETIME_ALARM_TYPE_NEGATIVE);
 
                 /* don't try to set this again if multiple timers are
@@ -227,7 +292,7 @@ gpm_idletime_set_reset_alarm (GpmIdletime *idletime,
                 idletime->priv->reset_set = TRUE;
 
                 current = gpm_idletime_get_time (idletime);
-                reset_threshold = gpm_idletime_xsyncvalue_to_int64 (alarm_item->timeout);
+                reset_threshold = gpm_idletime_xsyncvalue_to_int64 (wait_value);
                 if (current < reset_threshold) {
                         /* We've missed the alarm already */
                         gpm_idletime_alarm_reset_all (idletime);
@@ -235,20 +300,6 @@ gpm_idletime_set_reset_alarm (GpmIdletime *idletime,
         }
 }
 
-static GpmIdletimeAlarm *
-gpm_idletime_alarm_find_event (GpmIdletime *idletime,
-                               XSyncAlarmNotifyEvent *alarm_event)
-{
-        guint i;
-        GpmIdletimeAlarm *alarm_item;
-        for (i = 0; i < idletime->priv->array->len; i++) {
-                alarm_item = g_ptr_array_index (idletime->priv->array, i);
-                if (alarm_event->alarm == alarm_item->xalarm)
-                        return alarm_item;
-        }
-        return NULL;
-}
-
 static GdkFilterReturn
 gpm_idletime_event_filter_cb (GdkXEvent *gdkxevent,
                               GdkEvent *event,
@@ -258,6 +309,10 @@ gpm_idletime_event_filter_cb (GdkXEvent *gdkxevent,
         XEvent *xevent = (XEvent *) gdkxevent;
         GpmIdletime *idletime = (GpmIdletime *) data;
         XSyncAlarmNotifyEvent *alarm_event;
+        GArray *expired;
+        gint64 counter;
+        guint id;
+        guint i;
 
         /* no point continuing */
         if (xevent->type != idletime->priv->sync_event + XSyncAlarmNotify)
@@ -265,21 +320,45 @@ gpm_idletime_event_filter_cb (GdkXEvent *gdkxevent,
 
         alarm_event = (XSyncAlarmNotifyEvent *) xevent;
 
-        /* did we match one of our alarms? */
-        alarm_item = gpm_idletime_alarm_find_event (idletime, alarm_event);
-        if (alarm_item == NULL)
-                return GDK_FILTER_CONTINUE;
-
         /* are we the reset alarm? */
-        if (alarm_item->id == 0) {
+        if (alarm_event->alarm != None &&
+            alarm_event->alarm == idletime->priv->reset_xalarm) {
                 gpm_idletime_alarm_reset_all (idletime);
                 goto out;
         }
 
-        /* emit */
-        g_signal_emit (alarm_item->idletime,
-                       signals[SIGNAL_ALARM_EXPIRED],
-                       0, alarm_item->id);
+        /* did we match our stage alarm? */
+        if (alarm_event->alarm == None ||
+            alarm_event->alarm != idletime->priv->stage_xalarm)
+                return GDK_FILTER_CONTINUE;
+
+        /* the alarm has been re-armed since this was queued */
+        if (gpm_idletime_xsyncvalue_to_int64 (alarm_event->alarm_value) != idletime->priv->stage_value)
+                goto out;
+
+        /* expire every stage the counter has reached, several stages
+         * can share a timeout */
+        counter = gpm_idletime_xsyncvalue_to_int64 (alarm_event->counter_value);
+        expired = g_array_new (FALSE, FALSE, sizeof (guint));
+        while (idletime->priv->next_index < idletime->priv->array->len) {
+                alarm_item = g_ptr_array_index (idletime->priv->array, idletime->priv->next_index);
+                if (alarm_item->timeout > counter)
+                        break;
+                g_array_append_val (expired, alarm_item->id);
+                idletime->priv->next_index++;
+        }
+        idletime->priv->expired_value = counter;
+        idletime->priv->stage_value = -1;
+        gpm_idletime_stage_arm (idletime);
+
+        /* emit, the handlers may well change the stages */
+        for (i = 0; i < expired->len; i++) {
+                id = g_array_index (expired, guint, i);
+                g_signal_emit (idletime,
+                               signals[SIGNAL_ALARM_EXPIRED],
+                               0, id);
+        }
+        g_array_unref (expired);
 
         /* we need the first alarm to go off to set the reset alarm */
         gpm_idletime_set_reset_alarm (idletime, alarm_event);
@@ -288,20 +367,17 @@ out:
         return GDK_FILTER_REMOVE;
 }
 
-static GpmIdletimeAlarm *
-gpm_idletime_alarm_new (GpmIdletime *idletime, guint id)
+static gint
+gpm_idletime_alarm_compare_func (gconstpointer a, gconstpointer b)
 {
-        GpmIdletimeAlarm *alarm_item;
-
-        /* create a new alarm */
-        alarm_item = g_new0 (GpmIdletimeAlarm, 1);
-
-        /* set the default values */
-        alarm_item->id = id;
-        alarm_item->xalarm = None;
-        alarm_item->idletime = g_object_ref (idletime);
-
-        return alarm_item;
+        const GpmIdletimeAlarm *alarm_a = *((GpmIdletimeAlarm **) a);
+        const GpmIdletimeAlarm *alarm_b = *((GpmIdletimeAlarm **) b);
+
+        if (alarm_a->timeout < alarm_b->timeout)
+                return -1;
+        if (alarm_a->timeout > alarm_b->timeout)
+                return 1;
+        return 0;
 }
 
 gboolean
@@ -323,34 +399,17 @@ gpm_idletime_alarm_set (GpmIdletime *idletime,
         alarm_item = gpm_idletime_alarm_find_id (idletime, id);
         if (alarm_item == NULL) {
                 /* create a new alarm */
-                alarm_item = gpm_idletime_alarm_new (idletime, id);
+                alarm_item = g_new0 (GpmIdletimeAlarm, 1);
+                alarm_item->id = id;
                 g_ptr_array_add (idletime->priv->array, alarm_item);
+        } else if (alarm_item->timeout == timeout) {
+                return TRUE;
         }
 
-        /* set the timeout */
-        XSyncIntToValue (&alarm_item->timeout, (gint)timeout);
-
-        /* set, and start the timer */
-        gpm_idletime_xsync_alarm_set (idletime,
-                                      alarm_item,
-                                      GPM_IDLETIME_ALARM_TYPE_POSITIVE);
-        return TRUE;
-}
-
-static gboolean
-gpm_idletime_alarm_free (GpmIdletime *idletime,
-                         GpmIdletimeAlarm *alarm_item)
-{
-        g_return_val_if_fail (GPM_IS_IDLETIME (idletime), FALSE);
-        g_return_val_if_fail (alarm_item != NULL, FALSE);
-
-        if (alarm_item->xalarm) {
-                XSyncDestroyAlarm (idletime->priv->dpy,
-                                   alarm_item->xalarm);
-        }
-        g_object_unref (alarm_item->idletime);
-        g_ptr_array_remove (idletime->priv->array, alarm_item);
-        g_free (alarm_item);
+        /* set the timeout, and re-arm if it is the next one due */
+        alarm_item->timeout = timeout;
+        g_ptr_array_sort (idletime->priv->array, gpm_idletime_alarm_compare_func);
+        gpm_idletime_stage_update (idletime);
         return TRUE;
 }
 
@@ -364,7 +423,9 @@ gpm_idletime_alarm_remove (GpmIdletime *idletime, guint id)
         alarm_item = gpm_idletime_alarm_find_id (idletime, id);
         if (alarm_item == NULL)
                 return FALSE;
-        gpm_idletime_alarm_free (idletime, alarm_item);
+        g_ptr_array_remove (idletime->priv->array, alarm_item);
+        g_free (alarm_item);
+        gpm_idletime_stage_update (idletime);
         return TRUE;
 }
 
@@ -397,17 +458,21 @@ gpm_idletime_init (GpmIdletime *idletime)
         int sync_error;
         int ncounters;
         XSyncSystemCounter *counters;
-        GpmIdletimeAlarm *alarm_item;
         gint major, minor;
         guint i;
 
         idletime->priv = GPM_IDLETIME_GET_PRIVATE (idletime);
 
-        idletime->priv->array = g_ptr_array_new ();
+        idletime->priv->array = g_ptr_array_new_with_free_func (g_free);
 
         idletime->priv->reset_set = FALSE;
         idletime->priv->idle_counter = None;
         idletime->priv->sync_event = 0;
+        idletime->priv->next_index = 0;
+        idletime->priv->expired_value = -1;
+        idletime->priv->stage_xalarm = None;
+        idletime->priv->stage_value = -1;
+        idletime->priv->reset_xalarm = None;
         idletime->priv->dpy = GDK_DISPLAY_XDISPLAY (gdk_display_get_default());
 
         /* get the sync event */
@@ -441,18 +506,12 @@ gpm_idletime_init (GpmIdletime *idletime)
         gdk_window_add_filter (NULL,
                                gpm_idletime_event_filter_cb,
                                idletime);
-
-        /* create a reset alarm */
-        alarm_item = gpm_idletime_alarm_new (idletime, 0);
-        g_ptr_array_add (idletime->priv->array, alarm_item);
 }
 
 static void
 gpm_idletime_finalize (GObject *object)
 {
-        guint i;
         GpmIdletime *idletime;
-        GpmIdletimeAlarm *alarm_item;
 
         g_return_if_fail (object != NULL);
         g_return_if_fail (GPM_IS_IDLETIME (object));
@@ -465,11 +524,11 @@ gpm_idletime_finalize (GObject *object)
                                   gpm_idletime_event_filter_cb,
                                   idletime);
 
-        /* free all counters, including reset counter */
-        for (i = 0; i < idletime->priv->array->len; i++) {
-                alarm_item = g_ptr_array_index (idletime->priv->array, i);
-                gpm_idletime_alarm_free (idletime, alarm_item);
-        }
+        /* free both alarms and all the stages */
+        if (idletime->priv->stage_xalarm)
+                XSyncDestroyAlarm (idletime->priv->dpy, idletime->priv->stage_xalarm);
+        if (idletime->priv->reset_xalarm)
+                XSyncDestroyAlarm (idletime->priv->dpy, idletime->priv->reset_xalarm);
         g_ptr_array_free (idletime->priv->array, TRUE);
 
         G_OBJECT_CLASS (gpm_idletime_parent_class)->finalize (object);
@@ -480,4 +539,3 @@ gpm_idletime_new (void)
 {
         return g_object_new (GPM_IDLETIME_TYPE, NULL);
 }
-
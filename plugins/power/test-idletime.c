@@ -0,0 +1,135 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: nil; c-basic-offset: 8 -*-
+ *
+ * Licensed under the GNU General Public License Version 2
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include "config.h"
+
+#include <glib.h>
+#include <gdk/gdk.h>
+
+#include "gpm-idletime.h"
+
+/* needs an X server with the IDLETIME counter, and no input while it runs */
+
+#define TEST_ID_DIM             1
+#define TEST_ID_BLANK           2
+#define TEST_ID_SLEEP           3
+#define TEST_ID_LATE            4
+
+#define TEST_STAGE_INTERVAL     1000    /* ms */
+#define TEST_TIMEOUT            10      /* s */
+
+typedef struct {
+        GpmIdletime     *idletime;
+        GMainLoop       *loop;
+        GArray          *fired;
+        gint64           base;
+        gboolean         add_late;
+} TestData;
+
+static void
+alarm_expired_cb (GpmIdletime *idletime, guint id, TestData *data)
+{
+        g_array_append_val (data->fired, id);
+
+        /* what the power manager does when it dims, with the signal
+         * still being emitted */
+        if (id == TEST_ID_DIM) {
+                gpm_idletime_alarm_set (idletime, TEST_ID_BLANK,
+                                        data->base + 2 * TEST_STAGE_INTERVAL + 1);
+                /* and a stage the counter has already passed */
+                if (data->add_late)
+                        gpm_idletime_alarm_set (idletime, TEST_ID_LATE,
+                                                data->base + TEST_STAGE_INTERVAL / 2);
+        }
+
+        if (id == TEST_ID_SLEEP)
+                g_main_loop_quit (data->loop);
+}
+
+static gboolean
+timeout_cb (gpointer user_data)
+{
+        g_assert_not_reached ();
+        return G_SOURCE_REMOVE;
+}
+
+static void
+run_stages (gboolean add_late)
+{
+        TestData data = { 0 };
+        guint timeout_id;
+
+        data.idletime = gpm_idletime_new ();
+        data.loop = g_main_loop_new (NULL, FALSE);
+        data.fired = g_array_new (FALSE, FALSE, sizeof (guint));
+        data.add_late = add_late;
+        g_signal_connect (data.idletime, "alarm-expired",
+                          G_CALLBACK (alarm_expired_cb), &data);
+
+        /* the counter may already be well past zero */
+        data.base = gpm_idletime_get_time (data.idletime);
+        gpm_idletime_alarm_set (data.idletime, TEST_ID_DIM,
+                                data.base + TEST_STAGE_INTERVAL);
+        gpm_idletime_alarm_set (data.idletime, TEST_ID_BLANK,
+                                data.base + 2 * TEST_STAGE_INTERVAL);
+        gpm_idletime_alarm_set (data.idletime, TEST_ID_SLEEP,
+                                data.base + 3 * TEST_STAGE_INTERVAL);
+
+        timeout_id = g_timeout_add_seconds (TEST_TIMEOUT, timeout_cb, NULL);
+        g_main_loop_run (data.loop);
+        g_source_remove (timeout_id);
+
+        /* every stage went off once, in order, and the late one not at all */
+        g_assert_cmpint (data.fired->len, ==, 3);
+        g_assert_cmpint (g_array_index (data.fired, guint, 0), ==, TEST_ID_DIM);
+        g_assert_cmpint (g_array_index (data.fired, guint, 1), ==, TEST_ID_BLANK);
+        g_assert_cmpint (g_array_index (data.fired, guint, 2), ==, TEST_ID_SLEEP);
+
+        g_array_unref (data.fired);
+        g_main_loop_unref (data.loop);
+        g_object_unref (data.idletime);
+}
+
+static void
+gpm_test_idletime_rearm_in_handler (void)
+{
+        run_stages (FALSE);
+}
+
+static void
+gpm_test_idletime_passed_stage (void)
+{
+        run_stages (TRUE);
+}
+
+int
+main (int argc, char **argv)
+{
+        g_test_init (&argc, &argv, NULL);
+
+        if (!gdk_init_check (&argc, &argv)) {
+                g_test_message ("no display, skipping");
+                return 77;
+        }
+
+        g_test_add_func ("/power/idletime/rearm-in-handler", gpm_test_idletime_rearm_in_handler);
+        g_test_add_func ("/power/idletime/passed-stage", gpm_test_idletime_passed_stage);
+
+        return g_test_run ();
+}
@@ -20,7 +20,10 @@
 
 #include "config.h"
 
+#include <string.h>
+
 #include <glib/gi18n-lib.h>
+#include <glib/gstdio.h>
 #include <gio/gio.h>
 
 #include "csd-xsettings-gtk.h"
@@ -41,11 +44,20 @@ struct CsdXSettingsGtkPrivate {
 
         GSettings         *settings;
 
-        guint64            dir_mtime;
         GFileMonitor      *monitor;
-        GList             *cond_settings;
+        GHashTable        *module_files;        /* file name -> GtkModuleFile */
+        GHashTable        *cond_settings;       /* schema -> GSettings */
 };
 
+/* What a file in GTK_MODULES_DIRECTORY said when it was last read */
+typedef struct {
+        guint64  mtime;
+        guint64  inode;
+        char    *module_name;   /* NULL if it doesn't describe a module */
+        char    *schema;        /* only enabled when this key is set */
+        char    *key;
+} GtkModuleFile;
+
 #define CSD_XSETTINGS_GTK_GET_PRIVATE(object) (G_TYPE_INSTANCE_GET_PRIVATE ((object), CSD_TYPE_XSETTINGS_GTK, CsdXSettingsGtkPrivate))
 
 G_DEFINE_TYPE(CsdXSettingsGtk, csd_xsettings_gtk, G_TYPE_OBJECT)
@@ -53,15 +65,48 @@ G_DEFINE_TYPE(CsdXSettingsGtk, csd_xsettings_gtk, G_TYPE_OBJECT)
 static void update_gtk_modules (CsdXSettingsGtk *gtk);
 
 static void
-empty_cond_settings_list (CsdXSettingsGtk *gtk)
+gtk_module_file_free (GtkModuleFile *module_file)
 {
-        if (gtk->priv->cond_settings == NULL)
-                return;
+        g_free (module_file->module_name);
+        g_free (module_file->schema);
+        g_free (module_file->key);
+        g_slice_free (GtkModuleFile, module_file);
+}
+
+/* the modules from the directory that are currently enabled */
+static void
+update_dir_modules (CsdXSettingsGtk *gtk)
+{
+        GHashTableIter iter;
+        gpointer value;
+        GHashTable *ht;
+
+        ht = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+
+        g_hash_table_iter_init (&iter, gtk->priv->module_files);
+        while (g_hash_table_iter_next (&iter, NULL, &value)) {
+                GtkModuleFile *module_file = value;
+
+                if (module_file->module_name == NULL)
+                        continue;
+
+                if (module_file->schema != NULL) {
+                        GSettings *settings;
+
+                        if (module_file->key == NULL)
+                                continue;
+                        settings = g_hash_table_lookup (gtk->priv->cond_settings,
+                                                        module_file->schema);
+                        if (!g_settings_get_boolean (settings, module_file->key))
+                                continue;
+                }
+
+                g_hash_table_add (ht, g_strdup (module_file->module_name));
+        }
 
-        /* Empty the list of settings */
-        g_list_foreach (gtk->priv->cond_settings, (GFunc) g_object_unref, NULL);
-        g_list_free (gtk->priv->cond_settings);
-        gtk->priv->cond_settings = NULL;
+        if (gtk->priv->dir_modules != NULL)
+                g_hash_table_destroy (gtk->priv->dir_modules);
+        gtk->priv->dir_modules = ht;
 }
 
 static void
@@ -69,36 +114,34 @@ cond_setting_changed (GSettings       *settings,
                       const char      *key,
                       CsdXSettingsGtk *gtk)
 {
-        gboolean enabled;
-        const char *module_name;
-
-        module_name = g_object_get_data (G_OBJECT (settings), "module-name");
-
-        enabled = g_settings_get_boolean (settings, key);
-        if (enabled != FALSE) {
-                if (gtk->priv->dir_modules == NULL)
-                        gtk->priv->dir_modules = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
-                g_hash_table_insert (gtk->priv->dir_modules, g_strdup (module_name), NULL);
-        } else if (gtk->priv->dir_modules != NULL) {
-                g_hash_table_remove (gtk->priv->dir_modules, module_name);
-        }
-
+        update_dir_modules (gtk);
         update_gtk_modules (gtk);
 }
 
-static char *
+/* the settings are shared by all the files using the schema, and kept
+ * across rescans */
+static void
+ensure_cond_settings (CsdXSettingsGtk *gtk,
+                      const char      *schema)
+{
+        GSettings *settings;
+
+        if (g_hash_table_contains (gtk->priv->cond_settings, schema))
+                return;
+
+        settings = g_settings_new (schema);
+        g_signal_connect_object (G_OBJECT (settings), "changed", G_CALLBACK (cond_setting_changed), gtk, 0);
+        g_hash_table_insert (gtk->priv->cond_settings, g_strdup (schema), settings);
+}
+
+static GtkModuleFile *
 process_desktop_file (const char      *path,
                       CsdXSettingsGtk *gtk)
 {
         GKeyFile *keyfile;
-        char *retval;
-        char *module_name;
+        GtkModuleFile *module_file;
 
-        retval = NULL;
-
-        if (g_str_has_suffix (path, ".desktop") == FALSE &&
-            g_str_has_suffix (path, ".gtk-module") == FALSE)
-                return retval;
+        module_file = g_slice_new0 (GtkModuleFile);
 
         keyfile = g_key_file_new ();
         if (g_key_file_load_from_file (keyfile, path, G_KEY_FILE_NONE, NULL) == FALSE)
@@ -107,115 +150,91 @@ process_desktop_file (const char      *path,
         if (g_key_file_has_group (keyfile, "GTK Module") == FALSE)
                 goto bail;
 
-        module_name = g_key_file_get_string (keyfile, "GTK Module", "X-GTK-Module-Name", NULL);
-        if (module_name == NULL)
+        module_file->module_name = g_key_file_get_string (keyfile, "GTK Module", "X-GTK-Module-Name", NULL);
+        if (module_file->module_name == NULL)
                 goto bail;
 
         if (g_key_file_has_key (keyfile, "GTK Module", "X-GTK-Module-Enabled-Schema", NULL) != FALSE) {
-                char *schema;
-                char *key;
-                gboolean enabled;
-                GSettings *settings;
-                char *signal;
-
-                schema = g_key_file_get_string (keyfile, "GTK Module", "X-GTK-Module-Enabled-Schema", NULL);
-                key = g_key_file_get_string (keyfile, "GTK Module", "X-GTK-Module-Enabled-Key", NULL);
-
-                settings = g_settings_new (schema);
-                enabled = g_settings_get_boolean (settings, key);
-
-                gtk->priv->cond_settings = g_list_prepend (gtk->priv->cond_settings, settings);
-
-                g_object_set_data_full (G_OBJECT (settings), "module-name", g_strdup (module_name), (GDestroyNotify) g_free);
-
-                signal = g_strdup_printf ("changed::%s", key);
-                g_signal_connect_object (G_OBJECT (settings), signal, G_CALLBACK (cond_setting_changed), gtk, 0);
-                g_free (signal);
-                g_free (schema);
-                g_free (key);
-
-                if (enabled != FALSE)
-                        retval = g_strdup (module_name);
-        } else {
-                retval = g_strdup (module_name);
+                module_file->schema = g_key_file_get_string (keyfile, "GTK Module", "X-GTK-Module-Enabled-Schema", NULL);
+                module_file->key = g_key_file_get_string (keyfile, "GTK Module", "X-GTK-Module-Enabled-Key", NULL);
+                ensure_cond_settings (gtk, module_file->schema);
         }
 
-	g_free (module_name);
-
 bail:
         g_key_file_free (keyfile);
-        return retval;
+        return module_file;
 }
 
 static void
 get_gtk_modules_from_dir (CsdXSettingsGtk *gtk)
 {
-        GFile *file;
-        GFileInfo *info;
-        GHashTable *ht;
+        GDir *dir;
+        const char *name;
+        GHashTable *seen;
+        GHashTable *schemas;
+        GHashTableIter iter;
+        gpointer key, value;
+
+        seen = g_hash_table_new (g_str_hash, g_str_equal);
+
+        /* only files that are new or were changed get read */
+        dir = g_dir_open (GTK_MODULES_DIRECTORY, 0, NULL);
+        while (dir != NULL && (name = g_dir_read_name (dir)) != NULL) {
+                GtkModuleFile *module_file;
+                GStatBuf buf;
+                char *path;
+
+                if (g_str_has_suffix (name, ".desktop") == FALSE &&
+                    g_str_has_suffix (name, ".gtk-module") == FALSE)
+                        continue;
+
+                path = g_build_filename (GTK_MODULES_DIRECTORY, name, NULL);
+                if (g_stat (path, &buf) != 0) {
+                        g_free (path);
+                        continue;
+                }
 
-        file = g_file_new_for_path (GTK_MODULES_DIRECTORY);
-        info = g_file_query_info (file,
-                                  G_FILE_ATTRIBUTE_TIME_MODIFIED,
-                                  G_FILE_QUERY_INFO_NONE,
-                                  NULL,
-                                  NULL);
-        if (info != NULL) {
-                guint64 dir_mtime;
-
-                dir_mtime = g_file_info_get_attribute_uint64 (info, G_FILE_ATTRIBUTE_TIME_MODIFIED);
-                if (gtk->priv->dir_mtime == 0 ||
-                    dir_mtime > gtk->priv->dir_mtime) {
-                        GDir *dir;
-                        const char *name;
-
-                        empty_cond_settings_list (gtk);
-
-                        gtk->priv->dir_mtime = dir_mtime;
-
-                        if (gtk->priv->dir_modules != NULL) {
-                                g_hash_table_destroy (gtk->priv->dir_modules);
-                                gtk->priv->dir_modules = NULL;
-                        }
-
-                        dir = g_dir_open (GTK_MODULES_DIRECTORY, 0, NULL);
-                        if (dir == NULL)
-                                goto bail;
-
-                        ht = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
-
-                        while ((name = g_dir_read_name (dir)) != NULL) {
-                                char *path;
-                                char *module;
-
-                                path = g_build_filename (GTK_MODULES_DIRECTORY, name, NULL);
-                                module = process_desktop_file (path, gtk);
-                                if (module != NULL)
-                                        g_hash_table_insert (ht, module, NULL);
-                                g_free (path);
-                        }
-                        g_dir_close (dir);
-
-                        gtk->priv->dir_modules = ht;
+                module_file = g_hash_table_lookup (gtk->priv->module_files, name);
+                if (module_file == NULL ||
+                    module_file->mtime != (guint64) buf.st_mtime ||
+                    module_file->inode != (guint64) buf.st_ino) {
+                        g_debug ("Reading GTK module file %s", path);
+                        module_file = process_desktop_file (path, gtk);
+                        module_file->mtime = buf.st_mtime;
+                        module_file->inode = buf.st_ino;
+                        g_hash_table_replace (gtk->priv->module_files, g_strdup (name), module_file);
                 }
-        } else {
-                empty_cond_settings_list (gtk);
+                g_free (path);
+
+                /* the key is owned by the cache, and lives as long as this */
+                g_hash_table_lookup_extended (gtk->priv->module_files, name, &key, NULL);
+                g_hash_table_add (seen, key);
+        }
+        if (dir != NULL)
+                g_dir_close (dir);
+
+        /* forget the files that went away, and the settings only they used */
+        schemas = g_hash_table_new (g_str_hash, g_str_equal);
+        g_hash_table_iter_init (&iter, gtk->priv->module_files);
+        while (g_hash_table_iter_next (&iter, &key, &value)) {
+                GtkModuleFile *module_file = value;
+
+                if (!g_hash_table_contains (seen, key))
+                        g_hash_table_iter_remove (&iter);
+                else if (module_file->schema != NULL)
+                        g_hash_table_add (schemas, module_file->schema);
         }
 
-bail:
-        if (info != NULL)
-                g_object_unref (info);
-        g_object_unref (file);
-}
+        g_hash_table_iter_init (&iter, gtk->priv->cond_settings);
+        while (g_hash_table_iter_next (&iter, &key, NULL)) {
+                if (!g_hash_table_contains (schemas, key))
+                        g_hash_table_iter_remove (&iter);
+        }
 
-static void
-stringify_gtk_modules (gpointer key,
-                       gpointer value,
-                       GString *str)
-{
-        if (str->len != 0)
-                g_string_append_c (str, ':');
-        g_string_append (str, key);
+        g_hash_table_unref (schemas);
+        g_hash_table_unref (seen);
+
+        update_dir_modules (gtk);
 }
 
 static void
@@ -223,6 +242,7 @@ update_gtk_modules (CsdXSettingsGtk *gtk)
 {
         char **enabled, **disabled;
         GHashTable *ht;
+        GList *list, *l;
         guint i;
         GString *str;
         char *modules;
@@ -233,8 +253,6 @@ update_gtk_modules (CsdXSettingsGtk *gtk)
         ht = g_hash_table_new (g_str_hash, g_str_equal);
 
         if (gtk->priv->dir_modules != NULL) {
-                GList *list, *l;
-
                 list = g_hash_table_get_keys (gtk->priv->dir_modules);
                 for (l = list; l != NULL; l = l->next) {
                         g_hash_table_insert (ht, l->data, NULL);
@@ -248,8 +266,15 @@ update_gtk_modules (CsdXSettingsGtk *gtk)
         for (i = 0; disabled[i] != NULL; i++)
                 g_hash_table_remove (ht, disabled[i]);
 
+        /* sorted, so that the same modules always give the same string */
         str = g_string_new (NULL);
-        g_hash_table_foreach (ht, (GHFunc) stringify_gtk_modules, str);
+        list = g_list_sort (g_hash_table_get_keys (ht), (GCompareFunc) strcmp);
+        for (l = list; l != NULL; l = l->next) {
+                if (str->len != 0)
+                        g_string_append_c (str, ':');
+                g_string_append (str, l->data);
+        }
+        g_list_free (list);
         g_hash_table_destroy (ht);
 
         modules = g_string_free (str, FALSE);
@@ -290,6 +315,11 @@ csd_xsettings_gtk_init (CsdXSettingsGtk *gtk)
 
         gtk->priv->settings = g_settings_new (XSETTINGS_PLUGIN_SCHEMA);
 
+        gtk->priv->module_files = g_hash_table_new_full (g_str_hash, g_str_equal,
+                                                         g_free, (GDestroyNotify) gtk_module_file_free);
+        gtk->priv->cond_settings = g_hash_table_new_full (g_str_hash, g_str_equal,
+                                                          g_free, g_object_unref);
+
         get_gtk_modules_from_dir (gtk);
 
         file = g_file_new_for_path (GTK_MODULES_DIRECTORY);
@@ -331,7 +361,8 @@ csd_xsettings_gtk_finalize (GObject *object)
         if (gtk->priv->monitor != NULL)
                 g_object_unref (gtk->priv->monitor);
 
-        empty_cond_settings_list (gtk);
+        g_hash_table_destroy (gtk->priv->module_files);
+        g_hash_table_destroy (gtk->priv->cond_settings);
 
         G_OBJECT_CLASS (csd_xsettings_gtk_parent_class)->finalize (object);
 }
@@ -228,6 +228,7 @@
 #define DPI_FALLBACK 96
 
 typedef struct _TranslationEntry TranslationEntry;
+typedef struct _XResources XResources;
 typedef void (* TranslationFunc) (CinnamonSettingsXSettingsManager *manager,
                                   TranslationEntry      *trans,
                                   GVariant              *value);
@@ -260,6 +261,8 @@ struct CinnamonSettingsXSettingsManagerPrivate
         guint              monitors_changed_id;
 
         guint              notify_idle_id;
+
+        XResources        *xresources;
 };
 
 #define CSD_XSETTINGS_ERROR csd_xsettings_error_quark ()
@@ -492,23 +495,94 @@ static gboolean
 notify_idle (gpointer data)
 {
         CinnamonSettingsXSettingsManager *manager = data;
+        GBytes *settings;
         gint i;
+
+        manager->priv->notify_idle_id = 0;
+
+        /* nothing to tell the clients */
+        if (!xsettings_manager_has_changes (manager->priv->managers[0]))
+                return G_SOURCE_REMOVE;
+
+        /* every screen is given the same settings, so encode them once */
+        settings = xsettings_manager_serialize (manager->priv->managers[0]);
         for (i = 0; manager->priv->managers [i]; i++) {
-                xsettings_manager_notify (manager->priv->managers[i]);
+                xsettings_manager_publish (manager->priv->managers[i], settings);
         }
-        manager->priv->notify_idle_id = 0;
+        g_bytes_unref (settings);
         return G_SOURCE_REMOVE;
 }
 
 static void
 queue_notify (CinnamonSettingsXSettingsManager *manager)
 {
+        /* the end of the transaction takes care of it */
+        if (xsettings_manager_in_transaction (manager->priv->managers[0]))
+                return;
+
         if (manager->priv->notify_idle_id != 0)
                 return;
 
         manager->priv->notify_idle_id = g_idle_add (notify_idle, manager);
 }
 
+static void
+begin_changes (CinnamonSettingsXSettingsManager *manager)
+{
+        gint i;
+
+        for (i = 0; manager->priv->managers [i]; i++)
+                xsettings_manager_begin (manager->priv->managers [i]);
+}
+
+static void
+commit_changes (CinnamonSettingsXSettingsManager *manager)
+{
+        gboolean changed = FALSE;
+        gint i;
+
+        for (i = 0; manager->priv->managers [i]; i++) {
+                if (xsettings_manager_commit (manager->priv->managers [i]))
+                        changed = TRUE;
+        }
+
+        if (changed)
+                queue_notify (manager);
+}
+
+/* All the keys of one GSettings change-event are handled as one
+ * transaction, with the "changed" signals emitted in between by the
+ * default handler */
+static gboolean
+change_event_begin_cb (GSettings                        *settings,
+                       GQuark                           *keys,
+                       gint                              n_keys,
+                       CinnamonSettingsXSettingsManager *manager)
+{
+        begin_changes (manager);
+        return FALSE;
+}
+
+static gboolean
+change_event_commit_cb (GSettings                        *settings,
+                        GQuark                           *keys,
+                        gint                              n_keys,
+                        CinnamonSettingsXSettingsManager *manager)
+{
+        commit_changes (manager);
+        return FALSE;
+}
+
+static void
+connect_change_event (CinnamonSettingsXSettingsManager *manager,
+                      GSettings                        *settings)
+{
+        g_signal_connect_object (settings, "change-event",
+                                 G_CALLBACK (change_event_begin_cb), manager, 0);
+        g_signal_connect_object (settings, "change-event",
+                                 G_CALLBACK (change_event_commit_cb), manager, G_CONNECT_AFTER);
+}
+
 static double
 get_dpi_from_gsettings (CinnamonSettingsXSettingsManager *manager)
 {
@@ -717,72 +791,197 @@ xft_settings_set_xsettings (CinnamonSettingsXSettingsManager *manager,
         cinnamon_settings_profile_end (NULL);
 }
 
+/* RESOURCE_MANAGER split into lines, so that the Xft keys can be changed
+ * without rewriting the rest, and the property is only written when the
+ * result differs from what is there */
+typedef struct {
+        gchar *text;    /* the line as read, or NULL once changed */
+        gchar *key;     /* NULL if the line isn't a resource */
+        gchar *value;
+} XResourcesLine;
+
+struct _XResources {
+        gchar      *raw;        /* the property the lines reflect */
+        GPtrArray  *lines;
+        GHashTable *keys;       /* key -> XResourcesLine */
+};
+
 static void
-update_property (GString *props, const gchar* key, const gchar* value)
+xresources_line_free (XResourcesLine *line)
 {
-        gchar* needle;
-        size_t needle_len;
-        gchar* found = NULL;
-
-        /* update an existing property */
-        needle = g_strconcat (key, ":", NULL);
-        needle_len = strlen (needle);
-        if (g_str_has_prefix (props->str, needle))
-                found = props->str;
-        else 
-            found = strstr (props->str, needle);
-
-        if (found) {
-                size_t value_index;
-                gchar* end;
-
-                end = strchr (found, '\n');
-                value_index = (found - props->str) + needle_len + 1;
-                g_string_erase (props, value_index, end ? (end - found - needle_len) : -1);
-                g_string_insert (props, value_index, "\n");
-                g_string_insert (props, value_index, value);
-        } else {
-                g_string_append_printf (props, "%s:\t%s\n", key, value);
+        g_free (line->text);
+        g_free (line->key);
+        g_free (line->value);
+        g_slice_free (XResourcesLine, line);
+}
+
+static void
+xresources_free (XResources *xres)
+{
+        g_free (xres->raw);
+        g_ptr_array_unref (xres->lines);
+        g_hash_table_unref (xres->keys);
+        g_slice_free (XResources, xres);
+}
+
+static XResources *
+xresources_parse (const gchar *raw)
+{
+        XResources *xres;
+        gchar **lines;
+        guint i;
+
+        xres = g_slice_new0 (XResources);
+        xres->raw = g_strdup (raw);
+        xres->lines = g_ptr_array_new_with_free_func ((GDestroyNotify) xresources_line_free);
+        xres->keys = g_hash_table_new (g_str_hash, g_str_equal);
+
+        lines = g_strsplit (raw, "\n", -1);
+        for (i = 0; lines[i] != NULL; i++) {
+                XResourcesLine *line;
+                gchar *colon;
+
+                /* the text ends with a newline, which leaves an empty last item */
+                if (lines[i + 1] == NULL && lines[i][0] == '\0')
+                        break;
+
+                line = g_slice_new0 (XResourcesLine);
+                line->text = g_strdup (lines[i]);
+                g_ptr_array_add (xres->lines, line);
+
+                colon = strchr (lines[i], ':');
+                if (colon == NULL || lines[i][0] == '!' || lines[i][0] == '#')
+                        continue;
+
+                line->key = g_strstrip (g_strndup (lines[i], colon - lines[i]));
+                line->value = g_strstrip (g_strdup (colon + 1));
+
+                /* the first one wins, like before */
+                if (!g_hash_table_contains (xres->keys, line->key))
+                        g_hash_table_insert (xres->keys, line->key, line);
+        }
+        g_strfreev (lines);
+
+        return xres;
+}
+
+static void
+xresources_set (XResources  *xres,
+                const gchar *key,
+                const gchar *value)
+{
+        XResourcesLine *line;
+
+        line = g_hash_table_lookup (xres->keys, key);
+        if (line == NULL) {
+                line = g_slice_new0 (XResourcesLine);
+                line->key = g_strdup (key);
+                g_ptr_array_add (xres->lines, line);
+                g_hash_table_insert (xres->keys, line->key, line);
+        } else if (g_strcmp0 (line->value, value) == 0) {
+                return;
         }
 
-	g_free (needle);
+        g_clear_pointer (&line->text, g_free);
+        g_free (line->value);
+        line->value = g_strdup (value);
+}
+
+static gchar *
+xresources_to_string (XResources *xres)
+{
+        GString *str;
+        guint i;
+
+        str = g_string_sized_new (strlen (xres->raw) + 64);
+        for (i = 0; i < xres->lines->len; i++) {
+                XResourcesLine *line = g_ptr_array_index (xres->lines, i);
+
+                if (line->text != NULL)
+                        g_string_append (str, line->text);
+                else
+                        g_string_append_printf (str, "%s:\t%s", line->key, line->value);
+                g_string_append_c (str, '\n');
+        }
+
+        return g_string_free (str, FALSE);
+}
+
+static gchar *
+xresources_read (Display *dpy)
+{
+        Atom type;
+        int format;
+        unsigned long n_items;
+        unsigned long bytes_after;
+        unsigned char *data = NULL;
+        gchar *raw;
+
+        if (XGetWindowProperty (dpy, RootWindow (dpy, 0), XA_RESOURCE_MANAGER,
+                                0, G_MAXLONG, False, XA_STRING,
+                                &type, &format, &n_items, &bytes_after,
+                                &data) != Success || type != XA_STRING || format != 8) {
+                if (data != NULL)
+                        XFree (data);
+                return g_strdup ("");
+        }
+
+        raw = g_strndup ((const gchar *) data, n_items);
+        XFree (data);
+        return raw;
 }
 
 static void
-xft_settings_set_xresources (CinnamonSettingsXftSettings *settings)
+xft_settings_set_xresources (CinnamonSettingsXSettingsManager *manager,
+                             CinnamonSettingsXftSettings      *settings)
 {
-        GString    *add_string;
+        XResources *xres;
+        gchar      *raw;
+        gchar      *new_raw;
         char        dpibuf[G_ASCII_DTOSTR_BUF_SIZE];
         Display    *dpy;
 
         cinnamon_settings_profile_start (NULL);
 
-        /* get existing properties */
-        dpy = XOpenDisplay (NULL);
-        g_return_if_fail (dpy != NULL);
-        add_string = g_string_new (XResourceManagerString (dpy));
-
-        g_debug("xft_settings_set_xresources: orig res '%s'", add_string->str);
+        /* get existing properties, only parsing them again if someone
+         * else changed them */
+        dpy = GDK_DISPLAY_XDISPLAY (gdk_display_get_default ());
+        raw = xresources_read (dpy);
+        if (manager->priv->xresources == NULL ||
+            strcmp (manager->priv->xresources->raw, raw) != 0) {
+                g_debug ("xft_settings_set_xresources: orig res '%s'", raw);
+                g_clear_pointer (&manager->priv->xresources, xresources_free);
+                manager->priv->xresources = xresources_parse (raw);
+        }
+        xres = manager->priv->xresources;
 
         g_snprintf (dpibuf, sizeof (dpibuf), "%d", (int) (settings->scaled_dpi / 1024.0 + 0.5));
-        update_property (add_string, "Xft.dpi", dpibuf);
-        update_property (add_string, "Xft.antialias",
-                                settings->antialias ? "1" : "0");
-        update_property (add_string, "Xft.hinting",
-                                settings->hinting ? "1" : "0");
-        update_property (add_string, "Xft.hintstyle",
-                                settings->hintstyle);
-        update_property (add_string, "Xft.rgba",
-                                settings->rgba);
-
-        g_debug("xft_settings_set_xresources: new res '%s'", add_string->str);
-
-        /* Set the new X property */
-        XChangeProperty(dpy, RootWindow (dpy, 0),
-                        XA_RESOURCE_MANAGER, XA_STRING, 8, PropModeReplace, (const unsigned char *) add_string->str, add_string->len);
-        XCloseDisplay (dpy);
+        xresources_set (xres, "Xft.dpi", dpibuf);
+        xresources_set (xres, "Xft.antialias",
+                        settings->antialias ? "1" : "0");
+        xresources_set (xres, "Xft.hinting",
+                        settings->hinting ? "1" : "0");
+        xresources_set (xres, "Xft.hintstyle",
+                        settings->hintstyle);
+        xresources_set (xres, "Xft.rgba",
+                        settings->rgba);
+
+        new_raw = xresources_to_string (xres);
+        if (strcmp (new_raw, raw) != 0) {
+                g_debug ("xft_settings_set_xresources: new res '%s'", new_raw);
+
+                /* Set the new X property */
+                XChangeProperty (dpy, RootWindow (dpy, 0),
+                                 XA_RESOURCE_MANAGER, XA_STRING, 8, PropModeReplace,
+                                 (const unsigned char *) new_raw, strlen (new_raw));
+                XFlush (dpy);
+
+                g_free (xres->raw);
+                xres->raw = g_steal_pointer (&new_raw);
+        }
 
-        g_string_free (add_string, TRUE);
+        g_free (new_raw);
+        g_free (raw);
 
         cinnamon_settings_profile_end (NULL);
 }
@@ -799,7 +998,7 @@ update_xft_settings (CinnamonSettingsXSettingsManager *manager)
 
         xft_settings_get (manager, &settings);
         xft_settings_set_xsettings (manager, &settings);
-        xft_settings_set_xresources (&settings);
+        xft_settings_set_xresources (manager, &settings);
 
         cinnamon_settings_profile_end (NULL);
 }
@@ -1250,12 +1449,14 @@ cinnamon_xsettings_manager_start (CinnamonSettingsXSettingsManager *manager,
 
         list = g_hash_table_get_values (manager->priv->settings);
         for (l = list; l != NULL; l = l->next) {
+                connect_change_event (manager, l->data);
                 g_signal_connect_object (G_OBJECT (l->data), "changed", G_CALLBACK (xsettings_callback), manager, 0);
         }
         g_list_free (list);
 
         /* Plugin settings (GTK modules and Xft) */
         manager->priv->plugin_settings = g_settings_new (XSETTINGS_PLUGIN_SCHEMA);
+        connect_change_event (manager, manager->priv->plugin_settings);
         g_signal_connect_object (manager->priv->plugin_settings, "changed", G_CALLBACK (plugin_callback), manager, 0);
 
         manager->priv->gtk = csd_xsettings_gtk_new ();
@@ -1322,6 +1523,11 @@ cinnamon_xsettings_manager_stop (CinnamonSettingsXSettingsManager *manager)
                 manager->priv->display_config_watch_id = 0;
         }
 
+        if (p->notify_idle_id != 0) {
+                g_source_remove (p->notify_idle_id);
+                p->notify_idle_id = 0;
+        }
+
         if (p->managers != NULL) {
                 for (i = 0; p->managers [i]; ++i)
                         xsettings_manager_destroy (p->managers [i]);
@@ -1346,6 +1552,8 @@ cinnamon_xsettings_manager_stop (CinnamonSettingsXSettingsManager *manager)
                 g_object_unref (p->gtk);
                 p->gtk = NULL;
         }
+
+        g_clear_pointer (&p->xresources, xresources_free);
 }
 
 static GObject *
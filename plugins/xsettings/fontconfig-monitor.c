@@ -21,9 +21,14 @@
 
 #include "fontconfig-monitor.h"
 
+#include <string.h>
+
 #include <gio/gio.h>
+#include <glib/gstdio.h>
 #include <fontconfig/fontconfig.h>
 
+#include "cinnamon-settings-profile.h"
+
 #define TIMEOUT_SECONDS 2
 
 static void
@@ -39,102 +44,412 @@ fontconfig_cache_init (void)
         FcInit ();
 }
 
-gboolean
-fontconfig_cache_update (void)
+/* Font directories can number in the thousands, so the watches are
+ * bounded: the directories of the configuration files come first, then
+ * the font directory trees level by level from their roots, as far as
+ * they fit. The directories left over are only noticed by comparing
+ * their stamps when a watch above them next fires, so a change in one of
+ * them alone waits for the next event in a watched parent. */
+#define MAX_WATCHES 512
+
+#define MONITOR_PATH_KEY "fontconfig-monitor-path"
+
+typedef struct {
+        gint64  mtime;
+        goffset size;
+} DirStamp;
+
+struct _fontconfig_monitor_handle {
+        GHashTable *monitors;           /* path -> GFileMonitor */
+        GHashTable *config_dirs;        /* watched configuration directories */
+        GHashTable *stamps;             /* font directory -> DirStamp */
+        GHashTable *changed;            /* watched paths with pending events */
+
+        guint timeout;
+
+        /* a reinit is running in a thread, and whether another was
+         * asked for in the meantime */
+        GCancellable *reinit_cancellable;
+        gboolean      reinit_pending;
+
+        GFunc    notify_callback;
+        gpointer notify_data;
+};
+
+typedef struct {
+        FcConfig   *config;
+        GHashTable *stamps;
+        gint64      elapsed;
+} ReinitData;
+
+static void
+dir_stamp_get (const gchar *path,
+               DirStamp    *stamp)
 {
-        return !FcConfigUptoDate (NULL) && FcInitReinitialize ();
+        GStatBuf buf;
+
+        if (g_stat (path, &buf) != 0) {
+                stamp->mtime = -1;
+                stamp->size = -1;
+                return;
+        }
+        stamp->mtime = buf.st_mtime;
+        stamp->size = buf.st_size;
+}
+
+static GHashTable *
+stamps_create (FcConfig *config)
+{
+        GHashTable *stamps;
+        FcStrList *list;
+        const char *str;
+
+        stamps = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, g_free);
+
+        list = FcConfigGetFontDirs (config);
+        while ((str = (const char *) FcStrListNext (list))) {
+                DirStamp *stamp = g_new (DirStamp, 1);
+
+                dir_stamp_get (str, stamp);
+                g_hash_table_replace (stamps, g_strdup (str), stamp);
+        }
+        FcStrListDone (list);
+
+        return stamps;
+}
+
+static gboolean
+path_is_below (const gchar *path,
+               const gchar *root)
+{
+        gsize len = strlen (root);
+
+        return strncmp (path, root, len) == 0 &&
+               (path[len] == '\0' || path[len] == G_DIR_SEPARATOR);
+}
+
+static gboolean
+stamp_refresh (DirStamp    *stamp,
+               const gchar *path)
+{
+        DirStamp now;
+
+        dir_stamp_get (path, &now);
+        if (now.mtime == stamp->mtime && now.size == stamp->size)
+                return FALSE;
+
+        g_debug ("font directory %s changed", path);
+        *stamp = now;
+        return TRUE;
+}
+
+/* restamps @root and the directories below it that have no watch of
+ * their own, returns whether any changed */
+static gboolean
+stamps_resync (fontconfig_monitor_handle_t *handle,
+               const gchar                 *root)
+{
+        GHashTableIter iter;
+        gpointer key, value;
+        gboolean changed = FALSE;
+
+        g_hash_table_iter_init (&iter, handle->stamps);
+        while (g_hash_table_iter_next (&iter, &key, &value)) {
+                if (!path_is_below (key, root))
+                        continue;
+                if (strcmp (key, root) != 0 &&
+                    g_hash_table_contains (handle->monitors, key))
+                        continue;
+
+                if (stamp_refresh (value, key))
+                        changed = TRUE;
+        }
+
+        return changed;
+}
+
+/* the number of font directories above @path */
+static guint
+stamps_get_depth (GHashTable  *stamps,
+                  const gchar *path)
+{
+        gchar *dir = g_path_get_dirname (path);
+        guint depth = 0;
+
+        /* g_path_get_dirname() ends up at "/" or "." */
+        while (strcmp (dir, G_DIR_SEPARATOR_S) != 0 &&
+               strcmp (dir, ".") != 0) {
+                gchar *parent;
+
+                if (g_hash_table_contains (stamps, dir))
+                        depth++;
+                parent = g_path_get_dirname (dir);
+                g_free (dir);
+                dir = parent;
+        }
+        g_free (dir);
+
+        return depth;
+}
+
+typedef struct {
+        const gchar *path;
+        guint        depth;
+} FontDirDepth;
+
+static gint
+font_dir_depth_compare (gconstpointer a,
+                        gconstpointer b)
+{
+        const FontDirDepth *dir_a = a;
+        const FontDirDepth *dir_b = b;
+
+        if (dir_a->depth != dir_b->depth)
+                return dir_a->depth < dir_b->depth ? -1 : 1;
+        return strcmp (dir_a->path, dir_b->path);
 }
 
 static void
-monitor_files (GPtrArray *monitors,
-               FcStrList *list,
-               gpointer   data)
+monitor_free (GFileMonitor *monitor)
+{
+        g_file_monitor_cancel (monitor);
+        g_object_unref (monitor);
+}
+
+static gboolean
+wanted_add (GHashTable  *wanted,
+            const gchar *path)
 {
+        if (g_hash_table_size (wanted) >= MAX_WATCHES)
+                return FALSE;
+        g_hash_table_add (wanted, g_strdup (path));
+        return TRUE;
+}
+
+/* works out the watches for the current configuration, keeping those
+ * that are still wanted from last time */
+static void
+monitors_sync (fontconfig_monitor_handle_t *handle)
+{
+        GHashTable *wanted;
+        GArray *dirs;
+        GHashTableIter iter;
+        gpointer key, value;
+        FcStrList *list;
         const char *str;
+        guint i;
 
+        wanted = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+
+        /* the configuration files are watched through their directories */
+        g_hash_table_remove_all (handle->config_dirs);
+        list = FcConfigGetConfigFiles (NULL);
         while ((str = (const char *) FcStrListNext (list))) {
+                gchar *dir;
+
+                if (g_file_test (str, G_FILE_TEST_IS_DIR))
+                        dir = g_strdup (str);
+                else
+                        dir = g_path_get_dirname (str);
+                wanted_add (wanted, dir);
+                g_hash_table_add (handle->config_dirs, dir);
+        }
+        FcStrListDone (list);
+
+        /* then the font directories, roots first, one level at a time
+         * while there is room */
+        dirs = g_array_sized_new (FALSE, FALSE, sizeof (FontDirDepth),
+                                  g_hash_table_size (handle->stamps));
+        g_hash_table_iter_init (&iter, handle->stamps);
+        while (g_hash_table_iter_next (&iter, &key, NULL)) {
+                FontDirDepth dir;
+
+                dir.path = key;
+                dir.depth = stamps_get_depth (handle->stamps, key);
+                g_array_append_val (dirs, dir);
+        }
+        g_array_sort (dirs, font_dir_depth_compare);
+        for (i = 0; i < dirs->len; i++) {
+                if (!wanted_add (wanted, g_array_index (dirs, FontDirDepth, i).path))
+                        break;
+        }
+        g_array_unref (dirs);
+
+        g_hash_table_iter_init (&iter, handle->monitors);
+        while (g_hash_table_iter_next (&iter, &key, NULL)) {
+                if (!g_hash_table_contains (wanted, key))
+                        g_hash_table_iter_remove (&iter);
+        }
+
+        g_hash_table_iter_init (&iter, wanted);
+        while (g_hash_table_iter_next (&iter, &key, NULL)) {
                 GFile *file;
                 GFileMonitor *monitor;
 
-                file = g_file_new_for_path (str);
+                if (g_hash_table_contains (handle->monitors, key))
+                        continue;
 
+                file = g_file_new_for_path (key);
                 monitor = g_file_monitor (file, G_FILE_MONITOR_NONE, NULL, NULL);
-
                 g_object_unref (file);
 
                 if (!monitor)
                         continue;
 
-                g_signal_connect (monitor, "changed", G_CALLBACK (stuff_changed), data);
-
-                g_ptr_array_add (monitors, monitor);
+                value = g_strdup (key);
+                g_object_set_data_full (G_OBJECT (monitor), MONITOR_PATH_KEY, value, g_free);
+                g_signal_connect (monitor, "changed", G_CALLBACK (stuff_changed), handle);
+                g_hash_table_insert (handle->monitors, value, monitor);
         }
 
-        FcStrListDone (list);
+        g_debug ("watching %u of %u font and configuration directories",
+                 g_hash_table_size (handle->monitors),
+                 g_hash_table_size (handle->stamps) + g_hash_table_size (handle->config_dirs));
+
+        g_hash_table_unref (wanted);
 }
 
+static void
+reinit_data_free (ReinitData *reinit)
+{
+        if (reinit->config)
+                FcConfigDestroy (reinit->config);
+        if (reinit->stamps)
+                g_hash_table_unref (reinit->stamps);
+        g_free (reinit);
+}
 
-struct _fontconfig_monitor_handle {
-        GPtrArray *monitors;
+/* Rescanning the fonts can take seconds with large collections, so the
+ * new configuration is built in a thread and only made current here. */
+static void
+reinit_thread (GTask        *task,
+               gpointer      source_object,
+               gpointer      task_data,
+               GCancellable *cancellable)
+{
+        ReinitData *reinit = task_data;
+        gint64 start;
 
-        guint timeout;
+        if (FcConfigUptoDate (NULL)) {
+                g_task_return_boolean (task, FALSE);
+                return;
+        }
 
-        GFunc    notify_callback;
-        gpointer notify_data;
-};
+        cinnamon_settings_profile_start (NULL);
+        start = g_get_monotonic_time ();
+        reinit->config = FcInitLoadConfigAndFonts ();
+        if (reinit->config)
+                reinit->stamps = stamps_create (reinit->config);
+        reinit->elapsed = g_get_monotonic_time () - start;
+        cinnamon_settings_profile_end (NULL);
+
+        g_task_return_boolean (task, reinit->config != NULL);
+}
 
-static GPtrArray *
-monitors_create (gpointer data)
+static void reinit_start (fontconfig_monitor_handle_t *handle);
+
+static void
+reinit_done (GObject      *source_object,
+             GAsyncResult *res,
+             gpointer      data)
 {
-        GPtrArray *monitors = g_ptr_array_new ();
+        fontconfig_monitor_handle_t *handle = data;
+        ReinitData *reinit = g_task_get_task_data (G_TASK (res));
+        gboolean notify = FALSE;
+
+        /* stopped while the thread was running */
+        if (g_cancellable_is_cancelled (handle->reinit_cancellable)) {
+                g_object_unref (handle->reinit_cancellable);
+                g_slice_free (fontconfig_monitor_handle_t, handle);
+                return;
+        }
+        g_clear_object (&handle->reinit_cancellable);
+
+        if (g_task_propagate_boolean (G_TASK (res), NULL)) {
+                g_debug ("fontconfig reinitialised in %.1f ms",
+                         (gdouble) reinit->elapsed / 1000);
+                notify = FcConfigSetCurrent (reinit->config);
+                /* fontconfig >= 2.13.1 takes its own reference */
+#if FC_VERSION < 21301
+                if (notify)
+                        reinit->config = NULL;
+#endif
+        }
+
+        if (notify) {
+                g_hash_table_unref (handle->stamps);
+                handle->stamps = g_steal_pointer (&reinit->stamps);
+                monitors_sync (handle);
+        }
+
+        /* something changed again while we were busy */
+        if (handle->reinit_pending) {
+                handle->reinit_pending = FALSE;
+                reinit_start (handle);
+        }
 
-        monitor_files (monitors, FcConfigGetConfigFiles (NULL), data);
-        monitor_files (monitors, FcConfigGetFontDirs (NULL)   , data);
+        /* we finish modifying handle before calling the notify callback,
+         * allowing the callback to free the monitor if it decides to. */
 
-        return monitors;
+        if (notify && handle->notify_callback)
+                handle->notify_callback (data, handle->notify_data);
 }
 
 static void
-monitors_free (GPtrArray *monitors)
+reinit_start (fontconfig_monitor_handle_t *handle)
 {
-        if (!monitors)
+        GTask *task;
+
+        if (handle->reinit_cancellable) {
+                handle->reinit_pending = TRUE;
                 return;
+        }
 
-        g_ptr_array_foreach (monitors, (GFunc) g_object_unref, NULL);
-        g_ptr_array_free (monitors, TRUE);
+        handle->reinit_cancellable = g_cancellable_new ();
+        task = g_task_new (NULL, handle->reinit_cancellable, reinit_done, handle);
+        g_task_set_task_data (task, g_new0 (ReinitData, 1), (GDestroyNotify) reinit_data_free);
+        g_task_run_in_thread (task, reinit_thread);
+        g_object_unref (task);
 }
 
 static gboolean
 update (gpointer data)
 {
         fontconfig_monitor_handle_t *handle = data;
-        gboolean notify = FALSE;
+        GHashTableIter iter;
+        gpointer key;
+        gboolean changed = FALSE;
 
         handle->timeout = 0;
 
-        if (fontconfig_cache_update ()) {
-                notify = TRUE;
-                monitors_free (handle->monitors);
-                handle->monitors = monitors_create (data);
+        /* only look under the watches that fired */
+        g_hash_table_iter_init (&iter, handle->changed);
+        while (g_hash_table_iter_next (&iter, &key, NULL)) {
+                if (g_hash_table_contains (handle->config_dirs, key))
+                        changed = TRUE;
+                else if (stamps_resync (handle, key))
+                        changed = TRUE;
         }
+        g_hash_table_remove_all (handle->changed);
 
-        /* we finish modifying handle before calling the notify callback,
-         * allowing the callback to free the monitor if it decides to. */
-
-        if (notify && handle->notify_callback)
-                handle->notify_callback (data, handle->notify_data);
+        if (changed)
+                reinit_start (handle);
 
         return FALSE;
 }
 
 static void
-stuff_changed (GFileMonitor *monitor G_GNUC_UNUSED,
+stuff_changed (GFileMonitor *monitor,
                GFile *file G_GNUC_UNUSED,
                GFile *other_file G_GNUC_UNUSED,
                GFileMonitorEvent event_type G_GNUC_UNUSED,
                gpointer data)
 {
         fontconfig_monitor_handle_t *handle = data;
+        const gchar *path;
+
+        path = g_object_get_data (G_OBJECT (monitor), MONITOR_PATH_KEY);
+        g_hash_table_add (handle->changed, g_strdup (path));
 
         /* wait for quiescence */
         if (handle->timeout) {
@@ -154,7 +469,12 @@ fontconfig_monitor_start (GFunc    notify_callback,
 
         handle->notify_callback = notify_callback;
         handle->notify_data = notify_data;
-        handle->monitors = monitors_create (handle);
+        handle->monitors = g_hash_table_new_full (g_str_hash, g_str_equal,
+                                                  NULL, (GDestroyNotify) monitor_free);
+        handle->config_dirs = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+        handle->changed = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+        handle->stamps = stamps_create (NULL);
+        monitors_sync (handle);
 
         return handle;
 }
@@ -166,9 +486,19 @@ fontconfig_monitor_stop  (fontconfig_monitor_handle_t *handle)
           g_source_remove (handle->timeout);
           handle->timeout = 0;
         }
-        
-        monitors_free (handle->monitors);
-        handle->monitors = NULL;
+
+        g_clear_pointer (&handle->monitors, g_hash_table_unref);
+        g_clear_pointer (&handle->config_dirs, g_hash_table_unref);
+        g_clear_pointer (&handle->changed, g_hash_table_unref);
+        g_clear_pointer (&handle->stamps, g_hash_table_unref);
+
+        /* the handle goes away once the thread is done with it */
+        if (handle->reinit_cancellable) {
+                g_cancellable_cancel (handle->reinit_cancellable);
+                return;
+        }
+
+        g_slice_free (fontconfig_monitor_handle_t, handle);
 }
 
 #ifdef FONTCONFIG_MONITOR_TEST
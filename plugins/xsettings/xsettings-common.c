@@ -67,13 +67,15 @@ xsettings_setting_get (XSettingsSetting *setting)
   return NULL;
 }
 
-void
+/* Returns whether the effective value changed */
+gboolean
 xsettings_setting_set (XSettingsSetting *setting,
                        gint              tier,
                        GVariant         *value,
                        guint32           serial)
 {
   GVariant *old_value;
+  gboolean changed = FALSE;
 
   old_value = xsettings_setting_get (setting);
   if (old_value)
@@ -84,10 +86,17 @@ xsettings_setting_set (XSettingsSetting *setting,
   setting->value[tier] = value ? g_variant_ref_sink (value) : NULL;
 
   if (!xsettings_variant_equal0 (old_value, xsettings_setting_get (setting)))
-    setting->last_change_serial = serial;
+    {
+      setting->last_change_serial = serial;
+      g_clear_pointer (&setting->blob, g_free);
+      setting->blob_len = 0;
+      changed = TRUE;
+    }
 
   if (old_value)
     g_variant_unref (old_value);
+
+  return changed;
 }
 
 void
@@ -100,6 +109,7 @@ xsettings_setting_free (XSettingsSetting *setting)
       g_variant_unref (setting->value[i]);
 
   g_free (setting->name);
+  g_free (setting->blob);
 
   g_slice_free (XSettingsSetting, setting);
 }
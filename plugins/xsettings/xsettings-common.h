@@ -50,11 +50,16 @@ struct _XSettingsSetting
   char *name;
   GVariant *value[XSETTINGS_N_TIERS];
   unsigned long last_change_serial;
+
+  /* the setting as it appears in the property, or NULL if it has
+   * changed since it was last encoded */
+  guchar *blob;
+  gsize blob_len;
 };
 
 XSettingsSetting *xsettings_setting_new   (const gchar      *name);
 GVariant *        xsettings_setting_get   (XSettingsSetting *setting);
-void              xsettings_setting_set   (XSettingsSetting *setting,
+gboolean          xsettings_setting_set   (XSettingsSetting *setting,
                                            gint              tier,
                                            GVariant         *value,
                                            guint32           serial);
@@ -47,6 +47,11 @@ struct _XSettingsManager
   GHashTable *settings;
   unsigned long serial;
 
+  /* nesting of begin/commit, and whether anything changed since the
+   * settings were last published */
+  int transaction_depth;
+  gboolean changed;
+
   GVariant *overrides;
 };
 
@@ -147,6 +152,8 @@ xsettings_manager_new (Display                *display,
   manager->settings = g_hash_table_new_full (g_str_hash, g_str_equal, NULL, (GDestroyNotify) xsettings_setting_free);
   manager->serial = 0;
   manager->overrides = NULL;
+  manager->transaction_depth = 0;
+  manager->changed = FALSE;
 
   manager->window = XCreateSimpleWindow (display,
 					 RootWindow (display, screen),
@@ -215,7 +222,8 @@ xsettings_manager_set_setting (XSettingsManager *manager,
       g_hash_table_insert (manager->settings, setting->name, setting);
     }
 
-  xsettings_setting_set (setting, tier, value, manager->serial);
+  if (xsettings_setting_set (setting, tier, value, manager->serial))
+    manager->changed = TRUE;
 
   if (xsettings_setting_get (setting) == NULL)
     g_hash_table_remove (manager->settings, name);
@@ -272,85 +280,159 @@ xsettings_get_typecode (GVariant *value)
     }
 }
 
-static void
-align_string (GString *string,
-              gint     alignment)
-{
-  /* Adds nul-bytes to the string until its length is an even multiple
-   * of the specified alignment requirement.
-   */
-  while ((string->len % alignment) != 0)
-    g_string_append_c (string, '\0');
-}
+/* Rounds up to the next multiple of 4, the alignment of every field */
+#define XSETTINGS_PAD(n) (((n) + 3) & ~3)
 
 static void
-setting_store (XSettingsSetting *setting,
-               GString          *buffer)
+setting_encode (XSettingsSetting *setting)
 {
   XSettingsType type;
   GVariant *value;
+  const gchar *string = NULL;
+  gsize stringlen = 0;
+  gsize namelen;
   guint16 len16;
+  guint32 len32;
+  guint32 serial32;
+  guchar *pos;
 
   value = xsettings_setting_get (setting);
 
   type = xsettings_get_typecode (value);
 
-  g_string_append_c (buffer, type);
-  g_string_append_c (buffer, 0);
+  /* work out the size first, so the blob is filled in one go */
+  namelen = strlen (setting->name);
+  setting->blob_len = 4 + XSETTINGS_PAD (namelen) + 4;
+  if (type == XSETTINGS_TYPE_STRING)
+    {
+      string = g_variant_get_string (value, &stringlen);
+      setting->blob_len += 4 + XSETTINGS_PAD (stringlen);
+    }
+  else
+    setting->blob_len += g_variant_get_size (value);
+
+  /* the padding is all nul-bytes */
+  setting->blob = g_malloc0 (setting->blob_len);
+  pos = setting->blob;
 
-  len16 = strlen (setting->name);
-  g_string_append_len (buffer, (gchar *) &len16, 2);
-  g_string_append (buffer, setting->name);
-  align_string (buffer, 4);
+  pos[0] = type;
+  pos[1] = 0;
+  len16 = namelen;
+  memcpy (pos + 2, &len16, 2);
+  memcpy (pos + 4, setting->name, namelen);
+  pos += 4 + XSETTINGS_PAD (namelen);
 
-  g_string_append_len (buffer, (gchar *) &setting->last_change_serial, 4);
+  serial32 = setting->last_change_serial;
+  memcpy (pos, &serial32, 4);
+  pos += 4;
 
   if (type == XSETTINGS_TYPE_STRING)
     {
-      const gchar *string;
-      gsize stringlen;
-      guint32 len32;
-
-      string = g_variant_get_string (value, &stringlen);
       len32 = stringlen;
-      g_string_append_len (buffer, (gchar *) &len32, 4);
-      g_string_append (buffer, string);
-      align_string (buffer, 4);
+      memcpy (pos, &len32, 4);
+      memcpy (pos + 4, string, stringlen);
     }
   else
     /* GVariant format is the same as XSETTINGS format for the non-string types */
-    g_string_append_len (buffer, g_variant_get_data (value), g_variant_get_size (value));
+    memcpy (pos, g_variant_get_data (value), g_variant_get_size (value));
 }
 
-void
-xsettings_manager_notify (XSettingsManager *manager)
+GBytes *
+xsettings_manager_serialize (XSettingsManager *manager)
 {
-  GString *buffer;
+  XSettingsSetting *setting;
   GHashTableIter iter;
-  int n_settings;
+  guint32 n_settings;
+  guint32 serial32;
+  guchar *buffer;
+  guchar *pos;
+  gsize len;
   gpointer value;
 
   n_settings = g_hash_table_size (manager->settings);
 
-  buffer = g_string_new (NULL);
-  g_string_append_c (buffer, xsettings_byte_order ());
-  g_string_append_c (buffer, '\0');
-  g_string_append_c (buffer, '\0');
-  g_string_append_c (buffer, '\0');
+  /* only settings that changed since the last time need encoding */
+  len = 12;
+  g_hash_table_iter_init (&iter, manager->settings);
+  while (g_hash_table_iter_next (&iter, NULL, &value))
+    {
+      setting = value;
+      if (setting->blob == NULL)
+        setting_encode (setting);
+      len += setting->blob_len;
+    }
+
+  buffer = g_malloc (len);
+  buffer[0] = xsettings_byte_order ();
+  buffer[1] = '\0';
+  buffer[2] = '\0';
+  buffer[3] = '\0';
 
-  g_string_append_len (buffer, (gchar *) &manager->serial, 4);
-  g_string_append_len (buffer, (gchar *) &n_settings, 4);
+  serial32 = manager->serial;
+  memcpy (buffer + 4, &serial32, 4);
+  memcpy (buffer + 8, &n_settings, 4);
 
+  pos = buffer + 12;
   g_hash_table_iter_init (&iter, manager->settings);
   while (g_hash_table_iter_next (&iter, NULL, &value))
-    setting_store (value, buffer);
+    {
+      setting = value;
+      memcpy (pos, setting->blob, setting->blob_len);
+      pos += setting->blob_len;
+    }
+
+  return g_bytes_new_take (buffer, len);
+}
 
+/* Sets the property to the output of xsettings_manager_serialize(). Managers
+ * holding the same settings, like those of the different screens, can all
+ * be given the data serialized by one of them.
+ */
+void
+xsettings_manager_publish (XSettingsManager *manager,
+                           GBytes           *data)
+{
   XChangeProperty (manager->display, manager->window,
                    manager->xsettings_atom, manager->xsettings_atom,
-                   8, PropModeReplace, (guchar *) buffer->str, buffer->len);
+                   8, PropModeReplace,
+                   g_bytes_get_data (data, NULL), g_bytes_get_size (data));
 
-  g_string_free (buffer, TRUE);
   manager->serial++;
+  manager->changed = FALSE;
+}
+
+/* Groups changes to several settings so that they are published as one
+ * update. Transactions nest. */
+void
+xsettings_manager_begin (XSettingsManager *manager)
+{
+  manager->transaction_depth++;
+}
+
+/* Returns TRUE when the outermost transaction ends with changes that
+ * still need publishing */
+gboolean
+xsettings_manager_commit (XSettingsManager *manager)
+{
+  g_return_val_if_fail (manager->transaction_depth > 0, FALSE);
+
+  manager->transaction_depth--;
+
+  return manager->transaction_depth == 0 && manager->changed;
+}
+
+/* Publishing inside a transaction is left to the caller of the
+ * outermost xsettings_manager_commit() */
+gboolean
+xsettings_manager_in_transaction (XSettingsManager *manager)
+{
+  return manager->transaction_depth > 0;
+}
+
+gboolean
+xsettings_manager_has_changes (XSettingsManager *manager)
+{
+  return manager->changed;
 }
 
 void
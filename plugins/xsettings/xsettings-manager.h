@@ -51,8 +51,15 @@ void   xsettings_manager_set_string     (XSettingsManager *manager,
 void   xsettings_manager_set_color      (XSettingsManager *manager,
                                          const char       *name,
                                          XSettingsColor   *value);
-void   xsettings_manager_notify         (XSettingsManager *manager);
+GBytes *xsettings_manager_serialize     (XSettingsManager *manager);
+void   xsettings_manager_publish        (XSettingsManager *manager,
+                                         GBytes           *data);
 void   xsettings_manager_set_overrides  (XSettingsManager *manager,
                                          GVariant         *overrides);
 
+void     xsettings_manager_begin        (XSettingsManager *manager);
+gboolean xsettings_manager_commit       (XSettingsManager *manager);
+gboolean xsettings_manager_in_transaction (XSettingsManager *manager);
+gboolean xsettings_manager_has_changes  (XSettingsManager *manager);
+
 #endif /* XSETTINGS_MANAGER_H */